@@ -0,0 +1,715 @@
+// bench.cpp - Reproducible performance suite for the Merkle tree
+#include "kary_merkle_tree.h"
+#include "merkle_cap.h"
+#include "merkle_tree.h"
+#include "proof_format.h"
+#include "sha256_simd.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+struct BenchOptions {
+    size_t minLog = 10;
+    size_t maxLog = 20;
+    std::vector<size_t> leafSizes = {64};
+    std::vector<size_t> threads = {1};
+    std::vector<std::string> hashes = {"sha256"};
+    std::vector<size_t> arities;
+    std::set<std::string> ops = {"build", "proof", "proof_batch", "proof_encode", "verify", "verify_batch",
+                                 "verify_encoded", "verify_cap", "sha256"};
+    size_t batchSize = 1024;
+    size_t capDepth = 10;
+    double minSeconds = 0.2;
+    double regressionPercent = 10.0;
+    std::string jsonPath;
+    std::string comparePath;
+    std::string statsPath;
+    std::string label;
+};
+
+struct BenchResult {
+    std::string name;
+    std::string op;
+    size_t leaves = 0;
+    size_t leafSize = 0;
+    size_t threads = 1;
+    size_t operations = 0;
+    double seconds = 0;
+    double hashes = 0;   // hash invocations over all operations
+    double bytes = 0;    // bytes fed to the hash over all operations
+    size_t peakRssKb = 0;
+    double proofBytes = 0;  // average proof size, for proof and verify cases
+    double speedup = 0;     // build cases: serial time over this case's time
+    bool rootMismatch = false;  // a parallel build produced a different root
+
+    double nsPerOp() const { return seconds * 1e9 / operations; }
+    double hashesPerSec() const { return hashes / seconds; }
+    double bytesPerSec() const { return bytes / seconds; }
+};
+
+void printUsage() {
+    std::cout << "usage: merkle_bench [options]\n"
+              << "  --min-log N          smallest tree is 2^N leaves (default 10)\n"
+              << "  --max-log N          largest tree is 2^N leaves (default 20, up to 26)\n"
+              << "  --leaf-sizes A,B     leaf payload sizes in bytes (default 64)\n"
+              << "  --threads A,B        thread counts for build and verify_batch (default 1)\n"
+              << "  --hashes A,B         tree hash policies: sha256, blake3 (default sha256)\n"
+              << "  --ops A,B            subset of build,proof,proof_batch,proof_encode,verify,\n"
+              << "                       verify_batch,verify_encoded,verify_cap,sha256\n"
+              << "  --arities A,B        also run build, verify and verify_batch on k-ary trees\n"
+              << "                       (2, 4, 8, 16) to weigh proof size against verify time\n"
+              << "  --batch N            indices per proof_batch / verify_batch call (default 1024)\n"
+              << "  --cap-depth N        verify_cap checks truncated proofs against the level N\n"
+              << "                       below the root (default 10)\n"
+              << "  --min-time S         minimum seconds measured per case (default 0.2)\n"
+              << "  --label TEXT         stored in the JSON, e.g. a commit id\n"
+              << "  --json PATH          write results as JSON ('-' for stdout)\n"
+              << "  --compare PATH       compare ns/op with an earlier JSON run\n"
+              << "  --threshold PCT      slowdown reported as a regression (default 10)\n"
+              << "  --stats PATH         write instrumentation counters as JSON (MERKLE_STATS builds)\n";
+}
+
+std::vector<size_t> parseList(const std::string& text) {
+    std::vector<size_t> values;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        values.push_back(std::stoull(item));
+    }
+    return values;
+}
+
+BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage();
+            std::exit(0);
+        }
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("Missing value for " + arg);
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--min-log") {
+            options.minLog = std::stoull(value);
+        } else if (arg == "--max-log") {
+            options.maxLog = std::stoull(value);
+        } else if (arg == "--leaf-sizes") {
+            options.leafSizes = parseList(value);
+        } else if (arg == "--threads") {
+            options.threads = parseList(value);
+        } else if (arg == "--arities") {
+            options.arities = parseList(value);
+        } else if (arg == "--hashes") {
+            options.hashes.clear();
+            std::stringstream ss(value);
+            std::string hash;
+            while (std::getline(ss, hash, ',')) {
+                if (hash != Sha256Policy::name && hash != Blake3Policy::name) {
+                    throw std::invalid_argument("Unknown hash " + hash);
+                }
+                options.hashes.push_back(hash);
+            }
+        } else if (arg == "--ops") {
+            options.ops.clear();
+            std::stringstream ss(value);
+            std::string op;
+            while (std::getline(ss, op, ',')) {
+                options.ops.insert(op);
+            }
+        } else if (arg == "--batch") {
+            options.batchSize = std::stoull(value);
+        } else if (arg == "--cap-depth") {
+            options.capDepth = std::stoull(value);
+        } else if (arg == "--min-time") {
+            options.minSeconds = std::stod(value);
+        } else if (arg == "--label") {
+            options.label = value;
+        } else if (arg == "--json") {
+            options.jsonPath = value;
+        } else if (arg == "--compare") {
+            options.comparePath = value;
+        } else if (arg == "--stats") {
+            options.statsPath = value;
+        } else if (arg == "--threshold") {
+            options.regressionPercent = std::stod(value);
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+
+    if (options.minLog > options.maxLog || options.maxLog > 26 || options.batchSize == 0 ||
+        options.leafSizes.empty() || options.threads.empty()) {
+        throw std::invalid_argument("Invalid option values");
+    }
+    for (size_t arity : options.arities) {
+        if (arity != 2 && arity != 4 && arity != 8 && arity != 16) {
+            throw std::invalid_argument("Arity must be 2, 4, 8 or 16");
+        }
+    }
+    return options;
+}
+
+// Deterministic leaves so every run hashes the same data
+std::vector<ByteArray> makeLeaves(size_t count, size_t leafSize) {
+    std::vector<ByteArray> leaves(count, ByteArray(leafSize));
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (auto& leaf : leaves) {
+        for (auto& b : leaf) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            b = static_cast<byte>(state);
+        }
+    }
+    return leaves;
+}
+
+// Resets the kernel's peak-RSS watermark so each case reports its own peak.
+void resetPeakRss() {
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+}
+
+size_t readPeakRssKb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::stoull(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+// Runs body (which performs `perCall` operations) until minSeconds have passed.
+BenchResult measure(const BenchOptions& options, size_t perCall, const std::function<void()>& body) {
+    BenchResult result;
+    auto start = std::chrono::steady_clock::now();
+    do {
+        body();
+        result.operations += perCall;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (result.seconds < options.minSeconds);
+    return result;
+}
+
+// Times build(pool) at every thread count. The serial build (pool null) runs
+// first as the baseline, and is timed even if 1 is not among the counts:
+// each case gets its speedup over it, and a parallel build whose root differs
+// from the serial one is flagged.
+void runBuildCases(const BenchOptions& options, const std::function<Digest(ThreadPool*)>& build,
+                   const std::function<void(BenchResult, size_t)>& record) {
+    Digest serialRoot = build(nullptr);
+    resetPeakRss();
+    BenchResult serial = measure(options, 1, [&] { build(nullptr); });
+    serial.speedup = 1;
+    if (std::count_if(options.threads.begin(), options.threads.end(), [](size_t t) { return t <= 1; }) > 0) {
+        record(serial, 1);
+    }
+
+    for (size_t threads : options.threads) {
+        if (threads <= 1) {
+            continue;
+        }
+        resetPeakRss();
+        ThreadPool pool(threads);
+        bool matches = true;
+        BenchResult result = measure(options, 1, [&] { matches = build(&pool) == serialRoot && matches; });
+        result.speedup = serial.nsPerOp() / result.nsPerOp();
+        result.rootMismatch = !matches;
+        record(result, threads);
+    }
+}
+
+size_t pathLength(size_t index, size_t totalLeaves) {
+    size_t length = 0;
+    for (size_t size = totalLeaves; size > 1; size = (size + 1) / 2) {
+        if ((index ^ 1) < size) {
+            length++;
+        }
+        index /= 2;
+    }
+    return length;
+}
+
+template <typename HashPolicy>
+std::vector<BenchResult> runTreeCases(const BenchOptions& options, size_t leafCount, size_t leafSize) {
+    typedef BasicMerkleTree<HashPolicy> Tree;
+    std::vector<BenchResult> results;
+    std::vector<ByteArray> leaves = makeLeaves(leafCount, leafSize);
+    std::string suffix = "/n=" + std::to_string(leafCount) + "/leaf=" + std::to_string(leafSize);
+    // SHA-256 names carry no hash tag so older result files still compare.
+    if (!std::is_same_v<HashPolicy, Sha256Policy>) {
+        suffix += std::string("/hash=") + HashPolicy::name;
+    }
+
+    auto record = [&](BenchResult result, const std::string& op, size_t threads,
+                      double hashesPerOp, double bytesPerOp) {
+        result.op = op;
+        result.name = op + suffix + "/threads=" + std::to_string(threads);
+        result.leaves = leafCount;
+        result.leafSize = leafSize;
+        result.threads = threads;
+        result.hashes = hashesPerOp * result.operations;
+        result.bytes = bytesPerOp * result.operations;
+        result.peakRssKb = readPeakRssKb();
+        results.push_back(result);
+    };
+
+    // Every leaf is hashed once and every pair hash removes one node.
+    double buildHashes = 2.0 * leafCount - 1;
+    double buildBytes = double(leafCount) * leafSize + 64.0 * (leafCount - 1);
+
+    if (options.ops.count("build")) {
+        runBuildCases(options, [&](ThreadPool* pool) {
+            if (pool == nullptr) {
+                Tree built(leaves);
+                return built.getNodeHash(built.getLevelCount() - 1, 0);
+            }
+            Tree built(leaves, *pool);
+            return built.getNodeHash(built.getLevelCount() - 1, 0);
+        }, [&](BenchResult result, size_t threads) {
+            record(result, "build", threads, buildHashes, buildBytes);
+        });
+    }
+
+    Tree tree(leaves);
+    Digest root;
+    ByteArray rootBytes = tree.getRootHash();
+    std::copy(rootBytes.begin(), rootBytes.end(), root.begin());
+
+    // Spread requests over the tree so proofs do not all share a cache-hot path.
+    std::vector<size_t> indices(std::min(options.batchSize, leafCount));
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = (i * 2654435761ULL) % leafCount;
+    }
+
+    if (options.ops.count("proof")) {
+        resetPeakRss();
+        size_t next = 0;
+        BenchResult result = measure(options, 1, [&] {
+            tree.generateProof(indices[next++ % indices.size()]);
+        });
+        record(result, "proof", 1, 0, 0);
+    }
+
+    if (options.ops.count("proof_batch")) {
+        resetPeakRss();
+        BenchResult result = measure(options, indices.size(), [&] { tree.generateProofs(indices); });
+        record(result, "proof_batch", 1, 0, 0);
+    }
+
+    if (options.ops.count("proof_encode")) {
+        resetPeakRss();
+        ByteArray buffer(encodedProofSize(tree.getLevelCount() - 1));
+        size_t next = 0;
+        BenchResult result = measure(options, 1, [&] {
+            tree.encodeProof(indices[next++ % indices.size()], buffer);
+        });
+        record(result, "proof_encode", 1, 0, 0);
+    }
+
+    if (options.ops.count("verify") || options.ops.count("verify_batch") || options.ops.count("verify_encoded") ||
+        options.ops.count("verify_cap")) {
+        std::vector<std::vector<Digest>> proofs(indices.size());
+        std::vector<ProofCheck> checks;
+        double averagePath = 0;
+        for (size_t i = 0; i < indices.size(); i++) {
+            for (const ByteArray& sibling : tree.generateProof(indices[i])) {
+                Digest digest;
+                std::copy(sibling.begin(), sibling.end(), digest.begin());
+                proofs[i].push_back(digest);
+            }
+            averagePath += double(pathLength(indices[i], leafCount)) / indices.size();
+            checks.push_back({leaves[indices[i]], proofs[i], indices[i]});
+        }
+        double verifyHashes = 1 + averagePath;
+        double verifyBytes = leafSize + 64 * averagePath;
+        double proofBytes = sizeof(Digest) * averagePath;
+
+        if (options.ops.count("verify")) {
+            resetPeakRss();
+            size_t next = 0;
+            BenchResult result = measure(options, 1, [&] {
+                size_t k = next++ % indices.size();
+                if (!Tree::verifyProof(root, leaves[indices[k]], proofs[k], indices[k], leafCount)) {
+                    throw std::runtime_error("verification failed");
+                }
+            });
+            result.proofBytes = proofBytes;
+            record(result, "verify", 1, verifyHashes, verifyBytes);
+        }
+
+        if (options.ops.count("verify_batch")) {
+            for (size_t threads : options.threads) {
+                resetPeakRss();
+                std::unique_ptr<ThreadPool> pool;
+                if (threads > 1) {
+                    pool = std::make_unique<ThreadPool>(threads);
+                }
+                BenchResult result = measure(options, checks.size(), [&] {
+                    if (Tree::verifyBatch(root, checks, leafCount, pool.get()).countValid() != checks.size()) {
+                        throw std::runtime_error("batch verification failed");
+                    }
+                });
+                result.proofBytes = proofBytes;
+                record(result, "verify_batch", threads, verifyHashes, verifyBytes);
+            }
+        }
+
+        if (options.ops.count("verify_encoded")) {
+            // Parse and verify straight from wire bytes, as a receiver would.
+            std::vector<ByteArray> encoded(indices.size());
+            for (size_t i = 0; i < indices.size(); i++) {
+                encoded[i].resize(encodedProofSize(proofs[i].size()));
+                tree.encodeProof(indices[i], encoded[i]);
+            }
+            resetPeakRss();
+            size_t next = 0;
+            BenchResult result = measure(options, 1, [&] {
+                size_t k = next++ % indices.size();
+                std::optional<ProofView> view = ProofView::parse(encoded[k]);
+                if (!view || !view->verify<HashPolicy>(root, leaves[indices[k]])) {
+                    throw std::runtime_error("encoded verification failed");
+                }
+            });
+            record(result, "verify_encoded", 1, verifyHashes, verifyBytes);
+        }
+
+        if (options.ops.count("verify_cap")) {
+            // A verifier that has authenticated the level capDepth below the
+            // root checks proofs truncated at it, in batches.
+            size_t capLevel = tree.getLevelCount() - 1 - std::min(options.capDepth, tree.getLevelCount() - 1);
+            BasicMerkleCap<HashPolicy> cap(root, leafCount, capLevel, tree.getCap(capLevel));
+            std::vector<std::vector<Digest>> truncated(indices.size());
+            std::vector<ProofCheck> capChecks;
+            double capPath = 0;
+            for (size_t i = 0; i < indices.size(); i++) {
+                truncated[i] = tree.generateTruncatedProof(indices[i], capLevel);
+                capPath += double(truncated[i].size()) / indices.size();
+                capChecks.push_back({leaves[indices[i]], truncated[i], indices[i]});
+            }
+
+            for (size_t threads : options.threads) {
+                resetPeakRss();
+                std::unique_ptr<ThreadPool> pool;
+                if (threads > 1) {
+                    pool = std::make_unique<ThreadPool>(threads);
+                }
+                BenchResult result = measure(options, capChecks.size(), [&] {
+                    if (cap.verifyBatch(capChecks, pool.get()).countValid() != capChecks.size()) {
+                        throw std::runtime_error("cap verification failed");
+                    }
+                });
+                result.proofBytes = sizeof(Digest) * capPath;
+                record(result, "verify_cap", threads, 1 + capPath, leafSize + 64 * capPath);
+            }
+        }
+    }
+
+    return results;
+}
+
+// k-ary trees (kary_merkle_tree.h) of one arity: the build, and proofs
+// verified one at a time and in batches, with the proof size alongside.
+template <typename HashPolicy>
+std::vector<BenchResult> runArityCases(const BenchOptions& options, size_t leafCount, size_t leafSize, size_t arity) {
+    typedef BasicKaryMerkleTree<HashPolicy> Tree;
+    std::vector<BenchResult> results;
+    std::vector<ByteArray> leaves = makeLeaves(leafCount, leafSize);
+    std::string suffix = "/n=" + std::to_string(leafCount) + "/leaf=" + std::to_string(leafSize) +
+                         "/arity=" + std::to_string(arity);
+    if (!std::is_same_v<HashPolicy, Sha256Policy>) {
+        suffix += std::string("/hash=") + HashPolicy::name;
+    }
+
+    auto record = [&](BenchResult result, const std::string& op, size_t threads,
+                      double hashesPerOp, double bytesPerOp) {
+        result.op = op;
+        result.name = op + suffix + "/threads=" + std::to_string(threads);
+        result.leaves = leafCount;
+        result.leafSize = leafSize;
+        result.threads = threads;
+        result.hashes = hashesPerOp * result.operations;
+        result.bytes = bytesPerOp * result.operations;
+        result.peakRssKb = readPeakRssKb();
+        results.push_back(result);
+    };
+
+    Tree tree(leaves, arity);
+    size_t internalNodes = 0;
+    for (size_t level = 1; level < tree.getLevelCount(); level++) {
+        internalNodes += tree.getLevelSize(level);
+    }
+    // Every node but the root is read once as a child.
+    double buildHashes = double(leafCount) + internalNodes;
+    double buildBytes = double(leafCount) * leafSize + double(sizeof(Digest)) * (leafCount + internalNodes - 1);
+
+    if (options.ops.count("build")) {
+        runBuildCases(options, [&](ThreadPool* pool) {
+            if (pool == nullptr) {
+                Tree built(leaves, arity);
+                return built.getNodeHash(built.getLevelCount() - 1, 0);
+            }
+            Tree built(leaves, arity, *pool);
+            return built.getNodeHash(built.getLevelCount() - 1, 0);
+        }, [&](BenchResult result, size_t threads) {
+            record(result, "kary_build", threads, buildHashes, buildBytes);
+        });
+    }
+
+    if (!options.ops.count("verify") && !options.ops.count("verify_batch")) {
+        return results;
+    }
+
+    Digest root = tree.getNodeHash(tree.getLevelCount() - 1, 0);
+    std::vector<size_t> indices(std::min(options.batchSize, leafCount));
+    std::vector<std::vector<Digest>> proofs(indices.size());
+    std::vector<ProofCheck> checks;
+    double proofDigests = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = (i * 2654435761ULL) % leafCount;
+        proofs[i] = tree.generateProof(indices[i]);
+        proofDigests += double(proofs[i].size()) / indices.size();
+        checks.push_back({leaves[indices[i]], proofs[i], indices[i]});
+    }
+    double verifyHashes = double(tree.getLevelCount());
+    double verifyBytes = leafSize + sizeof(Digest) * (proofDigests + tree.getLevelCount() - 1);
+    double proofBytes = sizeof(Digest) * proofDigests;
+
+    if (options.ops.count("verify")) {
+        resetPeakRss();
+        size_t next = 0;
+        BenchResult result = measure(options, 1, [&] {
+            size_t k = next++ % indices.size();
+            if (!Tree::verifyProof(root, leaves[indices[k]], proofs[k], indices[k], leafCount, arity)) {
+                throw std::runtime_error("k-ary verification failed");
+            }
+        });
+        result.proofBytes = proofBytes;
+        record(result, "kary_verify", 1, verifyHashes, verifyBytes);
+    }
+
+    if (options.ops.count("verify_batch")) {
+        for (size_t threads : options.threads) {
+            resetPeakRss();
+            std::unique_ptr<ThreadPool> pool;
+            if (threads > 1) {
+                pool = std::make_unique<ThreadPool>(threads);
+            }
+            BenchResult result = measure(options, checks.size(), [&] {
+                if (Tree::verifyBatch(root, checks, leafCount, arity, pool.get()).countValid() != checks.size()) {
+                    throw std::runtime_error("k-ary batch verification failed");
+                }
+            });
+            result.proofBytes = proofBytes;
+            record(result, "kary_verify_batch", threads, verifyHashes, verifyBytes);
+        }
+    }
+    return results;
+}
+
+std::vector<BenchResult> runHashCases(const BenchOptions& options) {
+    std::vector<BenchResult> results;
+    for (size_t size : options.leafSizes) {
+        ByteArray message = makeLeaves(1, size)[0];
+        resetPeakRss();
+        BenchResult result = measure(options, 1024, [&] {
+            for (int i = 0; i < 1024; i++) {
+                sha256Digest(message.data(), message.size());
+            }
+        });
+        result.op = "sha256";
+        result.name = "sha256/size=" + std::to_string(size);
+        result.leafSize = size;
+        result.hashes = result.operations;
+        result.bytes = double(result.operations) * size;
+        result.peakRssKb = readPeakRssKb();
+        results.push_back(result);
+    }
+
+    // The internal-node shape through the multi-lane kernel.
+    ByteArray pairs = makeLeaves(1, 64 * 4096)[0];
+    std::vector<Digest> output(4096);
+    resetPeakRss();
+    BenchResult result = measure(options, output.size(), [&] {
+        sha256Batch64(pairs.data(), output.data(), output.size());
+    });
+    result.op = "sha256";
+    result.name = std::string("sha256_batch64/") + sha256BackendName(getSha256Backend());
+    result.leafSize = 64;
+    result.hashes = result.operations;
+    result.bytes = 64.0 * result.operations;
+    result.peakRssKb = readPeakRssKb();
+    results.push_back(result);
+    return results;
+}
+
+void printResult(const BenchResult& result) {
+    std::cout << std::left << std::setw(48) << result.name << std::right << std::fixed
+              << std::setw(14) << std::setprecision(1) << result.nsPerOp() << " ns/op"
+              << std::setw(12) << std::setprecision(2) << result.hashesPerSec() / 1e6 << " Mhash/s"
+              << std::setw(10) << std::setprecision(1) << result.bytesPerSec() / 1e6 << " MB/s"
+              << std::setw(10) << result.peakRssKb / 1024 << " MB peak";
+    if (result.proofBytes > 0) {
+        std::cout << std::setw(10) << std::setprecision(0) << result.proofBytes << " B proof";
+    }
+    if (result.speedup > 0) {
+        std::cout << "  speedup " << std::setprecision(2) << result.speedup << "x";
+    }
+    if (result.rootMismatch) {
+        std::cout << "  ROOT MISMATCH";
+    }
+    std::cout << std::endl;
+}
+
+// One result object per line, which keeps --compare a line-by-line read.
+void writeJson(std::ostream& out, const BenchOptions& options, const std::vector<BenchResult>& results) {
+    out << "{\n  \"label\": \"" << options.label << "\",\n"
+        << "  \"sha256_backend\": \"" << sha256BackendName(getSha256Backend()) << "\",\n"
+        << "  \"results\": [\n";
+    out << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"op\": \"" << r.op << "\""
+            << ", \"leaves\": " << r.leaves << ", \"leaf_size\": " << r.leafSize
+            << ", \"threads\": " << r.threads << ", \"operations\": " << r.operations
+            << ", \"ns_per_op\": " << r.nsPerOp() << ", \"hashes_per_sec\": " << r.hashesPerSec()
+            << ", \"bytes_per_sec\": " << r.bytesPerSec() << ", \"peak_rss_kb\": " << r.peakRssKb
+            << ", \"proof_bytes\": " << r.proofBytes;
+        if (r.speedup > 0) {
+            out << ", \"speedup\": " << r.speedup;
+        }
+        if (r.rootMismatch) {
+            out << ", \"root_mismatch\": true";
+        }
+        out << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// Returns the number of cases that slowed down by more than the threshold.
+size_t compareWithBaseline(const BenchOptions& options, const std::vector<BenchResult>& results) {
+    std::ifstream in(options.comparePath);
+    if (!in) {
+        throw std::runtime_error("Cannot read " + options.comparePath);
+    }
+
+    std::map<std::string, double> baseline;
+    std::regex pattern("\"name\": \"([^\"]+)\".*\"ns_per_op\": ([0-9.eE+-]+)");
+    std::string line;
+    std::smatch match;
+    while (std::getline(in, line)) {
+        if (std::regex_search(line, match, pattern)) {
+            baseline[match[1]] = std::stod(match[2]);
+        }
+    }
+
+    size_t regressions = 0;
+    std::cout << "\nComparison with " << options.comparePath << ":\n";
+    for (const BenchResult& result : results) {
+        auto it = baseline.find(result.name);
+        if (it == baseline.end()) {
+            continue;
+        }
+        double change = (result.nsPerOp() - it->second) / it->second * 100.0;
+        bool regressed = change > options.regressionPercent;
+        regressions += regressed;
+        std::ostringstream percent;
+        percent << std::fixed << std::setprecision(1) << std::showpos << change << "%";
+        std::cout << std::left << std::setw(48) << result.name << std::right << std::setw(10) << percent.str()
+                  << (regressed ? "  REGRESSION" : "") << std::endl;
+    }
+    return regressions;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "merkle_bench: " << e.what() << "\n\n";
+        printUsage();
+        return 2;
+    }
+
+    std::cout << "SHA-256 backend: " << sha256BackendName(getSha256Backend()) << std::endl;
+
+    std::vector<BenchResult> results;
+    auto add = [&](const std::vector<BenchResult>& batch) {
+        for (const BenchResult& result : batch) {
+            printResult(result);
+            results.push_back(result);
+        }
+    };
+
+    if (options.ops.count("sha256")) {
+        add(runHashCases(options));
+    }
+    for (size_t leafSize : options.leafSizes) {
+        for (size_t log = options.minLog; log <= options.maxLog; log++) {
+            for (const std::string& hash : options.hashes) {
+                if (hash == Blake3Policy::name) {
+                    add(runTreeCases<Blake3Policy>(options, size_t(1) << log, leafSize));
+                } else {
+                    add(runTreeCases<Sha256Policy>(options, size_t(1) << log, leafSize));
+                }
+                for (size_t arity : options.arities) {
+                    if (hash == Blake3Policy::name) {
+                        add(runArityCases<Blake3Policy>(options, size_t(1) << log, leafSize, arity));
+                    } else {
+                        add(runArityCases<Sha256Policy>(options, size_t(1) << log, leafSize, arity));
+                    }
+                }
+            }
+        }
+    }
+
+    if (!options.jsonPath.empty()) {
+        if (options.jsonPath == "-") {
+            writeJson(std::cout, options, results);
+        } else {
+            std::ofstream out(options.jsonPath);
+            writeJson(out, options, results);
+        }
+    }
+
+    if (!options.statsPath.empty()) {
+        if (options.statsPath == "-") {
+            writeStatsJson(std::cout, getStats());
+        } else {
+            std::ofstream out(options.statsPath);
+            writeStatsJson(out, getStats());
+        }
+    }
+
+    size_t mismatches = std::count_if(results.begin(), results.end(),
+                                      [](const BenchResult& result) { return result.rootMismatch; });
+    if (mismatches > 0) {
+        std::cerr << "merkle_bench: " << mismatches << " parallel build(s) differ from the serial root" << std::endl;
+        return 1;
+    }
+
+    if (!options.comparePath.empty() && compareWithBaseline(options, results) > 0) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,401 @@
+// blake3.cpp
+#include "blake3.h"
+#include "stats.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MERKLE_X86_KERNELS 1
+#endif
+
+namespace {
+
+const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+const uint32_t CHUNK_START = 1 << 0;
+const uint32_t CHUNK_END = 1 << 1;
+const uint32_t PARENT = 1 << 2;
+const uint32_t ROOT = 1 << 3;
+
+const size_t BLOCK_LEN = 64;
+const size_t CHUNK_LEN = 1024;
+
+// Message word order for each of the seven rounds: round r reads the words of
+// round r - 1 through the fixed BLAKE3 permutation.
+constexpr std::array<std::array<uint8_t, 16>, 7> makeSchedule() {
+    const uint8_t permutation[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+    std::array<std::array<uint8_t, 16>, 7> schedule = {};
+    for (uint8_t i = 0; i < 16; i++) {
+        schedule[0][i] = i;
+    }
+    for (size_t round = 1; round < 7; round++) {
+        for (size_t i = 0; i < 16; i++) {
+            schedule[round][i] = schedule[round - 1][permutation[i]];
+        }
+    }
+    return schedule;
+}
+
+constexpr std::array<std::array<uint8_t, 16>, 7> SCHEDULE = makeSchedule();
+
+inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline void g(uint32_t* v, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 7);
+}
+
+void compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter,
+              uint32_t blockLen, uint32_t flags, uint32_t out[16]) {
+    uint32_t v[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3],
+        uint32_t(counter), uint32_t(counter >> 32), blockLen, flags
+    };
+
+#pragma GCC unroll 7
+    for (const auto& s : SCHEDULE) {
+        g(v, 0, 4, 8, 12, block[s[0]], block[s[1]]);
+        g(v, 1, 5, 9, 13, block[s[2]], block[s[3]]);
+        g(v, 2, 6, 10, 14, block[s[4]], block[s[5]]);
+        g(v, 3, 7, 11, 15, block[s[6]], block[s[7]]);
+        g(v, 0, 5, 10, 15, block[s[8]], block[s[9]]);
+        g(v, 1, 6, 11, 12, block[s[10]], block[s[11]]);
+        g(v, 2, 7, 8, 13, block[s[12]], block[s[13]]);
+        g(v, 3, 4, 9, 14, block[s[14]], block[s[15]]);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+}
+
+void loadWords(const byte* data, size_t size, uint32_t words[16]) {
+    byte block[BLOCK_LEN] = {};
+    std::memcpy(block, data, size);
+    for (int i = 0; i < 16; i++) {
+        words[i] = uint32_t(block[4 * i]) | (uint32_t(block[4 * i + 1]) << 8) |
+                   (uint32_t(block[4 * i + 2]) << 16) | (uint32_t(block[4 * i + 3]) << 24);
+    }
+}
+
+void storeDigest(const uint32_t words[8], Digest& digest) {
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = byte(words[i]);
+        digest[4 * i + 1] = byte(words[i] >> 8);
+        digest[4 * i + 2] = byte(words[i] >> 16);
+        digest[4 * i + 3] = byte(words[i] >> 24);
+    }
+}
+
+// The last compression of a chunk or parent node, kept unevaluated until it is
+// known whether this node is the root.
+struct Output {
+    uint32_t cv[8];
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t blockLen;
+    uint32_t flags;
+
+    void chainingValue(uint32_t out[8]) const {
+        uint32_t full[16];
+        compress(cv, block, counter, blockLen, flags, full);
+        std::memcpy(out, full, 8 * sizeof(uint32_t));
+    }
+
+    Digest rootDigest() const {
+        uint32_t full[16];
+        compress(cv, block, 0, blockLen, flags | ROOT, full);
+        Digest digest;
+        storeDigest(full, digest);
+        return digest;
+    }
+};
+
+Output chunkOutput(const byte* data, size_t size, uint64_t chunkCounter) {
+    Output output;
+    std::memcpy(output.cv, IV, sizeof(IV));
+    output.counter = chunkCounter;
+
+    size_t blocks = size == 0 ? 1 : (size + BLOCK_LEN - 1) / BLOCK_LEN;
+    for (size_t b = 0; b + 1 < blocks; b++) {
+        uint32_t words[16];
+        uint32_t full[16];
+        loadWords(data + b * BLOCK_LEN, BLOCK_LEN, words);
+        compress(output.cv, words, chunkCounter, BLOCK_LEN, b == 0 ? CHUNK_START : 0, full);
+        std::memcpy(output.cv, full, sizeof(output.cv));
+    }
+
+    size_t lastSize = size - (blocks - 1) * BLOCK_LEN;
+    loadWords(data + (blocks - 1) * BLOCK_LEN, lastSize, output.block);
+    output.blockLen = uint32_t(lastSize);
+    output.flags = CHUNK_END | (blocks == 1 ? CHUNK_START : 0);
+    return output;
+}
+
+Output parentOutput(const uint32_t left[8], const uint32_t right[8]) {
+    Output output;
+    std::memcpy(output.cv, IV, sizeof(IV));
+    std::memcpy(output.block, left, 8 * sizeof(uint32_t));
+    std::memcpy(output.block + 8, right, 8 * sizeof(uint32_t));
+    output.counter = 0;
+    output.blockLen = BLOCK_LEN;
+    output.flags = PARENT;
+    return output;
+}
+
+#ifdef MERKLE_X86_KERNELS
+
+#define ROTR512(x, n) _mm512_ror_epi32((x), (n))
+
+#define G512(a, b, c, d, x, y)                                        \
+    a = _mm512_add_epi32(_mm512_add_epi32(a, b), x);                  \
+    d = ROTR512(_mm512_xor_si512(d, a), 16);                          \
+    c = _mm512_add_epi32(c, d);                                       \
+    b = ROTR512(_mm512_xor_si512(b, c), 12);                          \
+    a = _mm512_add_epi32(_mm512_add_epi32(a, b), y);                  \
+    d = ROTR512(_mm512_xor_si512(d, a), 8);                           \
+    c = _mm512_add_epi32(c, d);                                       \
+    b = ROTR512(_mm512_xor_si512(b, c), 7);
+
+// Sixteen single-block messages, zero-padded to 64 bytes each and stored back
+// to back, hashed one per lane. blockLens[i] is the real length of message i.
+__attribute__((target("avx512f")))
+void hash16Avx512(const byte* input, const uint32_t* blockLens, Digest* output) {
+    const __m512i stride = _mm512_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112,
+                                             128, 144, 160, 176, 192, 208, 224, 240);
+    __m512i m[16];
+    for (int t = 0; t < 16; t++) {
+        m[t] = _mm512_i32gather_epi32(_mm512_add_epi32(stride, _mm512_set1_epi32(t)), input, 4);
+    }
+
+    __m512i v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = _mm512_set1_epi32(int(IV[i]));
+    }
+    for (int i = 0; i < 4; i++) {
+        v[8 + i] = _mm512_set1_epi32(int(IV[i]));
+    }
+    v[12] = _mm512_setzero_si512();
+    v[13] = _mm512_setzero_si512();
+    v[14] = _mm512_loadu_si512(blockLens);
+    v[15] = _mm512_set1_epi32(int(CHUNK_START | CHUNK_END | ROOT));
+
+#pragma GCC unroll 7
+    for (int r = 0; r < 7; r++) {
+        const auto& s = SCHEDULE[r];
+        G512(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+        G512(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+        G512(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+        G512(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+        G512(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+        G512(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+        G512(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+        G512(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+    }
+
+    alignas(64) uint32_t words[8][16];
+    for (int i = 0; i < 8; i++) {
+        _mm512_store_si512(words[i], _mm512_xor_si512(v[i], v[i + 8]));
+    }
+    for (int lane = 0; lane < 16; lane++) {
+        uint32_t digestWords[8];
+        for (int i = 0; i < 8; i++) {
+            digestWords[i] = words[i][lane];
+        }
+        storeDigest(digestWords, output[lane]);
+    }
+}
+
+#undef G512
+#undef ROTR512
+
+#endif // MERKLE_X86_KERNELS
+
+const size_t LANES = 16;
+
+bool hasAvx512() {
+#ifdef MERKLE_X86_KERNELS
+    static const bool supported = __builtin_cpu_supports("avx512f");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+Digest digestOf(const byte* data, size_t size) {
+    if (size <= CHUNK_LEN) {
+        return chunkOutput(data, size, 0).rootDigest();
+    }
+
+    // Chaining values of completed subtrees, merged like a binary counter. The
+    // last chunk is held back so the root flag lands on the right node.
+    uint32_t stack[64][8];
+    size_t depth = 0;
+    uint64_t chunks = (size + CHUNK_LEN - 1) / CHUNK_LEN;
+
+    for (uint64_t chunk = 0; chunk + 1 < chunks; chunk++) {
+        uint32_t cv[8];
+        chunkOutput(data + chunk * CHUNK_LEN, CHUNK_LEN, chunk).chainingValue(cv);
+        for (uint64_t total = chunk + 1; (total & 1) == 0; total >>= 1) {
+            parentOutput(stack[--depth], cv).chainingValue(cv);
+        }
+        std::memcpy(stack[depth++], cv, sizeof(cv));
+    }
+
+    size_t lastOffset = (chunks - 1) * CHUNK_LEN;
+    Output output = chunkOutput(data + lastOffset, size - lastOffset, chunks - 1);
+    while (depth > 0) {
+        uint32_t cv[8];
+        output.chainingValue(cv);
+        output = parentOutput(stack[--depth], cv);
+    }
+    return output.rootDigest();
+}
+
+Digest pairOf(const Digest& left, const Digest& right) {
+    byte block[BLOCK_LEN];
+    std::memcpy(block, left.data(), left.size());
+    std::memcpy(block + left.size(), right.data(), right.size());
+    uint32_t words[16];
+    loadWords(block, BLOCK_LEN, words);
+
+    uint32_t full[16];
+    compress(IV, words, 0, BLOCK_LEN, CHUNK_START | CHUNK_END | ROOT, full);
+    Digest digest;
+    storeDigest(full, digest);
+    return digest;
+}
+
+} // namespace
+
+Digest blake3Digest(const byte* data, size_t size) {
+    MERKLE_COUNT_HASHES(1, size);
+    return digestOf(data, size);
+}
+
+Digest blake3Pair(const Digest& left, const Digest& right) {
+    MERKLE_COUNT_HASHES(1, 64);
+    return pairOf(left, right);
+}
+
+void blake3PairBatch(const Digest* children, Digest* parents, size_t count) {
+    static_assert(sizeof(Digest) == 32, "digests must be densely packed");
+    MERKLE_COUNT_HASHES(count, 64 * count);
+    size_t i = 0;
+#ifdef MERKLE_X86_KERNELS
+    if (hasAvx512()) {
+        uint32_t blockLens[LANES];
+        std::fill_n(blockLens, LANES, uint32_t(BLOCK_LEN));
+        for (; i + LANES <= count; i += LANES) {
+            hash16Avx512(reinterpret_cast<const byte*>(children + 2 * i), blockLens, parents + i);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        parents[i] = pairOf(children[2 * i], children[2 * i + 1]);
+    }
+}
+
+void blake3Batch(const byte* const* messages, const size_t* sizes, Digest* output, size_t count) {
+    MERKLE_COUNT_HASHES(count, std::accumulate(sizes, sizes + count, uint64_t(0)));
+#ifdef MERKLE_X86_KERNELS
+    if (hasAvx512()) {
+        // Messages of at most one block share the multi-lane kernel; longer
+        // ones have a chunk structure of their own and go one at a time.
+        alignas(64) byte blocks[LANES * BLOCK_LEN];
+        uint32_t blockLens[LANES];
+        size_t lanes[LANES];
+        size_t used = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            if (sizes[i] > BLOCK_LEN) {
+                output[i] = digestOf(messages[i], sizes[i]);
+                continue;
+            }
+            byte* block = blocks + used * BLOCK_LEN;
+            std::memcpy(block, messages[i], sizes[i]);
+            std::memset(block + sizes[i], 0, BLOCK_LEN - sizes[i]);
+            blockLens[used] = uint32_t(sizes[i]);
+            lanes[used++] = i;
+
+            if (used == LANES) {
+                Digest hashed[LANES];
+                hash16Avx512(blocks, blockLens, hashed);
+                for (size_t j = 0; j < LANES; j++) {
+                    output[lanes[j]] = hashed[j];
+                }
+                used = 0;
+            }
+        }
+        for (size_t j = 0; j < used; j++) {
+            output[lanes[j]] = digestOf(messages[lanes[j]], sizes[lanes[j]]);
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) {
+        output[i] = digestOf(messages[i], sizes[i]);
+    }
+}
+
+void Blake3Stream::update(const byte* data, size_t size) {
+    length += size;
+    if (chunkSize > 0) {
+        size_t take = std::min(size, CHUNK_LEN - chunkSize);
+        std::memcpy(chunk + chunkSize, data, take);
+        chunkSize += take;
+        data += take;
+        size -= take;
+        if (size == 0) {
+            return;
+        }
+        addChunk(chunk);
+        chunkSize = 0;
+    }
+
+    // A chunk with more input after it cannot be the root.
+    while (size > CHUNK_LEN) {
+        addChunk(data);
+        data += CHUNK_LEN;
+        size -= CHUNK_LEN;
+    }
+    std::memcpy(chunk, data, size);
+    chunkSize = size;
+}
+
+Digest Blake3Stream::finish() {
+    MERKLE_COUNT_HASHES(1, length);
+    Output output = chunkOutput(chunk, chunkSize, chunkCounter);
+    while (depth > 0) {
+        uint32_t cv[8];
+        output.chainingValue(cv);
+        output = parentOutput(stack[--depth], cv);
+    }
+    return output.rootDigest();
+}
+
+void Blake3Stream::addChunk(const byte* data) {
+    uint32_t cv[8];
+    chunkOutput(data, CHUNK_LEN, chunkCounter).chainingValue(cv);
+    for (uint64_t total = chunkCounter + 1; (total & 1) == 0; total >>= 1) {
+        parentOutput(stack[--depth], cv).chainingValue(cv);
+    }
+    std::memcpy(stack[depth++], cv, sizeof(cv));
+    chunkCounter++;
+}
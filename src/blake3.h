@@ -0,0 +1,43 @@
+// blake3.h
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include "hash.h"
+
+// Unkeyed BLAKE3 with the default 32-byte output.
+Digest blake3Digest(const byte* data, size_t size);
+
+// BLAKE3 of the 64-byte message left || right. That is a single compression,
+// which makes it far cheaper than SHA-256's two.
+Digest blake3Pair(const Digest& left, const Digest& right);
+
+// blake3Pair over children[2i], children[2i + 1] for every i < count, several
+// pairs at a time with AVX-512 when the CPU has it.
+void blake3PairBatch(const Digest* children, Digest* parents, size_t count);
+
+// Hashes count messages of arbitrary length. Messages of up to 64 bytes, the
+// usual size of a leaf, are hashed 16 at a time.
+void blake3Batch(const byte* const* messages, const size_t* sizes, Digest* output, size_t count);
+
+// Incremental BLAKE3. Whole 1 KiB chunks are hashed straight from the
+// caller's buffer; the chunk that might turn out to be the last is held back.
+class Blake3Stream {
+public:
+    void update(const byte* data, size_t size);
+
+    // The digest of everything passed to update(). The stream is spent after.
+    Digest finish();
+
+private:
+    // Chaining values of completed subtrees, enough for 2^54 chunks.
+    uint32_t stack[54][8];
+    size_t depth = 0;
+    uint64_t chunkCounter = 0;
+    byte chunk[1024];
+    size_t chunkSize = 0;
+    uint64_t length = 0;
+
+    void addChunk(const byte* data);
+};
+
+#endif // BLAKE3_H
@@ -1,15 +1,16 @@
 // hash.cpp
 #include "hash.h"
+#include "sha256_simd.h"
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
 
 ByteArray sha256(const ByteArray& data) {
-    ByteArray hash(SHA256_DIGEST_LENGTH);
-    SHA256_CTX sha256Context;
-    SHA256_Init(&sha256Context);
-    SHA256_Update(&sha256Context, data.data(), data.size());
-    SHA256_Final(hash.data(), &sha256Context);
-    return hash;
+    return digestToBytes(sha256Single(data.data(), data.size()));
+}
+
+Digest sha256Digest(const byte* data, size_t size) {
+    return sha256Single(data, size);
 }
 
 ByteArray stringToBytes(const std::string& str) {
@@ -27,4 +28,39 @@ std::string bytesToHexString(const ByteArray& bytes) {
 
 ByteArray commit(const ByteArray& data) {
     return sha256(data);
-}
\ No newline at end of file
+}
+
+Digest commitDigest(const ByteArray& data) {
+    return sha256Digest(data.data(), data.size());
+}
+
+Digest hashPair(const Digest& left, const Digest& right) {
+    byte combined[2 * SHA256_DIGEST_LENGTH];
+    std::copy(left.begin(), left.end(), combined);
+    std::copy(right.begin(), right.end(), combined + SHA256_DIGEST_LENGTH);
+    return sha256Digest(combined, sizeof(combined));
+}
+
+void commitBatch(const ByteArray* data, size_t count, Digest* output) {
+    const size_t chunk = 256;
+    const byte* messages[chunk];
+    size_t sizes[chunk];
+
+    for (size_t start = 0; start < count; start += chunk) {
+        size_t n = std::min(chunk, count - start);
+        for (size_t i = 0; i < n; i++) {
+            messages[i] = data[start + i].data();
+            sizes[i] = data[start + i].size();
+        }
+        sha256Batch(messages, sizes, output + start, n);
+    }
+}
+
+void hashPairs(const Digest* children, Digest* parents, size_t count) {
+    static_assert(sizeof(Digest) == SHA256_DIGEST_LENGTH, "digests must be densely packed");
+    sha256Batch64(reinterpret_cast<const byte*>(children), parents, count);
+}
+
+ByteArray digestToBytes(const Digest& digest) {
+    return ByteArray(digest.begin(), digest.end());
+}
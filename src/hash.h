@@ -2,6 +2,7 @@
 #ifndef HASH_H
 #define HASH_H
 
+#include <array>
 #include <string>
 #include <vector>
 #include <openssl/sha.h>
@@ -9,12 +10,30 @@
 typedef unsigned char byte;
 typedef std::vector<byte> ByteArray;
 
+// Fixed-size digest used for tree nodes, so node storage needs no heap allocation.
+typedef std::array<byte, SHA256_DIGEST_LENGTH> Digest;
+
 ByteArray sha256(const ByteArray& data);
 
+Digest sha256Digest(const byte* data, size_t size);
+
 ByteArray stringToBytes(const std::string& str);
 
 std::string bytesToHexString(const ByteArray& bytes);
 
 ByteArray commit(const ByteArray& data);
 
-#endif // HASH_H
\ No newline at end of file
+Digest commitDigest(const ByteArray& data);
+
+// Hash of the concatenation left || right, i.e. an internal tree node.
+Digest hashPair(const Digest& left, const Digest& right);
+
+// Batched forms of commitDigest and hashPair, hashed several messages at a time
+// by the multi-lane SHA-256 kernels. children holds 2 * count digests.
+void commitBatch(const ByteArray* data, size_t count, Digest* output);
+
+void hashPairs(const Digest* children, Digest* parents, size_t count);
+
+ByteArray digestToBytes(const Digest& digest);
+
+#endif // HASH_H
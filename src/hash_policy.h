@@ -0,0 +1,93 @@
+// hash_policy.h
+#ifndef HASH_POLICY_H
+#define HASH_POLICY_H
+
+#include "blake3.h"
+#include "hash.h"
+#include "sha256_simd.h"
+#include <algorithm>
+#include <cstdint>
+
+// A hash policy tells BasicMerkleTree how leaves and internal nodes are hashed.
+// It is a template argument, so the single-node calls inline into the tree
+// code. Every policy provides:
+//
+//   digestSize            output size in bytes
+//   hashId                identifier stored in tree file headers (tree_file.h)
+//   name                  short name for logs and benchmarks
+//   leaf(data, size)      digest of one leaf
+//   combine(left, right)  digest of an internal node
+//   leafBatch, combineBatch
+//                         the same over many inputs; children holds 2 * count
+//                         digests
+//   Stream                incremental leaf hasher with update(data, size) and
+//                         finish(), equal to leaf() over the concatenation
+
+struct Sha256Policy {
+    static constexpr size_t digestSize = SHA256_DIGEST_LENGTH;
+    static constexpr uint32_t hashId = 1;
+    static constexpr const char* name = "sha256";
+
+    typedef Sha256Stream Stream;
+
+    static Digest leaf(const byte* data, size_t size) {
+        return sha256Single(data, size);
+    }
+
+    static Digest combine(const Digest& left, const Digest& right) {
+        return hashPair(left, right);
+    }
+
+    static void leafBatch(const ByteArray* data, size_t count, Digest* output) {
+        commitBatch(data, count, output);
+    }
+
+    static void leafBatch(const byte* const* messages, const size_t* sizes, Digest* output, size_t count) {
+        sha256Batch(messages, sizes, output, count);
+    }
+
+    static void combineBatch(const Digest* children, Digest* parents, size_t count) {
+        hashPairs(children, parents, count);
+    }
+};
+
+struct Blake3Policy {
+    static constexpr size_t digestSize = 32;
+    static constexpr uint32_t hashId = 2;
+    static constexpr const char* name = "blake3";
+
+    typedef Blake3Stream Stream;
+
+    static Digest leaf(const byte* data, size_t size) {
+        return blake3Digest(data, size);
+    }
+
+    static Digest combine(const Digest& left, const Digest& right) {
+        return blake3Pair(left, right);
+    }
+
+    static void leafBatch(const ByteArray* data, size_t count, Digest* output) {
+        const size_t chunk = 256;
+        const byte* messages[chunk];
+        size_t sizes[chunk];
+
+        for (size_t start = 0; start < count; start += chunk) {
+            size_t n = std::min(chunk, count - start);
+            for (size_t i = 0; i < n; i++) {
+                messages[i] = data[start + i].data();
+                sizes[i] = data[start + i].size();
+            }
+            blake3Batch(messages, sizes, output + start, n);
+        }
+    }
+
+    static void leafBatch(const byte* const* messages, const size_t* sizes, Digest* output, size_t count) {
+        blake3Batch(messages, sizes, output, count);
+    }
+
+    static void combineBatch(const Digest* children, Digest* parents, size_t count) {
+        blake3PairBatch(children, parents, count);
+    }
+};
+
+#endif // HASH_POLICY_H
@@ -0,0 +1,278 @@
+// kary_merkle_tree.cpp
+#include "kary_merkle_tree.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Nodes handed to one multi-lane leafBatch call.
+const size_t BATCH_NODES = 256;
+
+// Leaves or parents per parallel task.
+const size_t PARALLEL_GRAIN = 4096;
+
+void checkArity(size_t arity) {
+    if (arity < 2 || arity > 16 || !std::has_single_bit(arity)) {
+        throw std::invalid_argument("Tree arity must be 2, 4, 8 or 16.");
+    }
+}
+
+// Digest of a node from its count >= 2 children, stored back to back.
+template <typename HashPolicy>
+Digest nodeDigest(const Digest* children, size_t count) {
+    if (count == 2) {
+        return HashPolicy::combine(children[0], children[1]);
+    }
+    return HashPolicy::leaf(children[0].data(), count * sizeof(Digest));
+}
+
+// Verifies up to VERIFY_GROUP proofs in lockstep; each level of the group is
+// one multi-lane hash of the assembled child lists.
+template <typename HashPolicy>
+void verifyGroup(const Digest& rootHash, const ProofCheck* checks, size_t count,
+                 size_t totalLeaves, size_t arity, bool* results) {
+    const byte* messages[VERIFY_GROUP];
+    size_t sizes[VERIFY_GROUP];
+    Digest current[VERIFY_GROUP];
+    size_t index[VERIFY_GROUP];
+    size_t proofPos[VERIFY_GROUP];
+
+    for (size_t i = 0; i < count; i++) {
+        messages[i] = checks[i].data.data();
+        sizes[i] = checks[i].data.size();
+        index[i] = checks[i].index;
+        proofPos[i] = 0;
+        results[i] = checks[i].index < totalLeaves;
+    }
+    HashPolicy::leafBatch(messages, sizes, current, count);
+
+    Digest children[VERIFY_GROUP][BasicKaryMerkleTree<HashPolicy>::MAX_ARITY];
+    Digest hashed[VERIFY_GROUP];
+    size_t lanes[VERIFY_GROUP];
+
+    for (size_t nodesInLevel = totalLeaves; nodesInLevel > 1; nodesInLevel = (nodesInLevel + arity - 1) / arity) {
+        size_t nodeCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!results[i]) {
+                continue;
+            }
+            size_t first = index[i] / arity * arity;
+            size_t childCount = std::min(arity, nodesInLevel - first);
+            if (childCount == 1) {
+                continue;
+            }
+            if (checks[i].proof.size() - proofPos[i] < childCount - 1) {
+                results[i] = false;
+                continue;
+            }
+            Digest* list = children[nodeCount];
+            for (size_t c = 0; c < childCount; c++) {
+                list[c] = first + c == index[i] ? current[i] : checks[i].proof[proofPos[i]++];
+            }
+            messages[nodeCount] = list[0].data();
+            sizes[nodeCount] = childCount * sizeof(Digest);
+            lanes[nodeCount++] = i;
+        }
+
+        HashPolicy::leafBatch(messages, sizes, hashed, nodeCount);
+        for (size_t j = 0; j < nodeCount; j++) {
+            current[lanes[j]] = hashed[j];
+        }
+        for (size_t i = 0; i < count; i++) {
+            index[i] /= arity;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        results[i] = results[i] && proofPos[i] == checks[i].proof.size() && current[i] == rootHash;
+    }
+}
+
+} // namespace
+
+template <typename HashPolicy>
+BasicKaryMerkleTree<HashPolicy>::BasicKaryMerkleTree(const std::vector<ByteArray>& data, size_t arity) {
+    if (data.empty()) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+
+    allocateLevels(data.size(), arity);
+
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        HashPolicy::leafBatch(data.data(), numLeaves, nodes.data());
+    }
+
+    MERKLE_PHASE(Phase::LevelBuilding);
+    for (size_t level = 1; level < getLevelCount(); level++) {
+        buildLevel(level, 0, levelSize(level));
+    }
+}
+
+template <typename HashPolicy>
+BasicKaryMerkleTree<HashPolicy>::BasicKaryMerkleTree(const std::vector<ByteArray>& data, size_t arity,
+                                                     ThreadPool& pool) {
+    if (data.empty()) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+
+    allocateLevels(data.size(), arity);
+
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        pool.parallelFor(0, numLeaves, PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+            HashPolicy::leafBatch(&data[begin], end - begin, nodes.data() + begin);
+        });
+    }
+
+    // A level is at most 1/arity of the one below, so per-level parallelism
+    // runs out within a few levels and the rest is cheap.
+    MERKLE_PHASE(Phase::LevelBuilding);
+    for (size_t level = 1; level < getLevelCount(); level++) {
+        pool.parallelFor(0, levelSize(level), PARALLEL_GRAIN, [&](size_t begin, size_t end) {
+            buildLevel(level, begin, end);
+        });
+    }
+}
+
+template <typename HashPolicy>
+void BasicKaryMerkleTree<HashPolicy>::allocateLevels(size_t leafCount, size_t treeArity) {
+    checkArity(treeArity);
+    numLeaves = leafCount;
+    arity = treeArity;
+    arityBits = std::countr_zero(treeArity);
+
+    levelOffsets.assign(1, 0);
+    for (size_t size = leafCount; ; size = (size + arity - 1) / arity) {
+        levelOffsets.push_back(levelOffsets.back() + size);
+        if (size == 1) {
+            break;
+        }
+    }
+    nodes.resize(levelOffsets.back());
+}
+
+template <typename HashPolicy>
+void BasicKaryMerkleTree<HashPolicy>::buildLevel(size_t level, size_t begin, size_t end) {
+    const Digest* children = levelData(level - 1);
+    Digest* parents = nodes.data() + levelOffsets[level];
+    size_t childCount = levelSize(level - 1);
+
+    // Parents with a full set of children are batched; their child lists are
+    // already contiguous in the level below, so nothing is copied.
+    size_t fullEnd = std::min(end, childCount / arity);
+    if (begin < fullEnd) {
+        if (arity == 2) {
+            HashPolicy::combineBatch(children + 2 * begin, parents + begin, fullEnd - begin);
+        } else {
+            const byte* messages[BATCH_NODES];
+            size_t sizes[BATCH_NODES];
+            for (size_t start = begin; start < fullEnd; start += BATCH_NODES) {
+                size_t count = std::min(BATCH_NODES, fullEnd - start);
+                for (size_t i = 0; i < count; i++) {
+                    messages[i] = children[(start + i) * arity].data();
+                    sizes[i] = arity * sizeof(Digest);
+                }
+                HashPolicy::leafBatch(messages, sizes, parents + start, count);
+            }
+        }
+    }
+
+    // Only the last node of a level can have fewer children.
+    for (size_t j = std::max(begin, fullEnd); j < end; j++) {
+        size_t first = j * arity;
+        size_t count = std::min(arity, childCount - first);
+        parents[j] = count == 1 ? children[first] : nodeDigest<HashPolicy>(children + first, count);
+    }
+}
+
+template <typename HashPolicy>
+ByteArray BasicKaryMerkleTree<HashPolicy>::getRootHash() const {
+    return digestToBytes(levelData(getLevelCount() - 1)[0]);
+}
+
+template <typename HashPolicy>
+const Digest& BasicKaryMerkleTree<HashPolicy>::getNodeHash(size_t level, size_t index) const {
+    if (level >= getLevelCount() || index >= levelSize(level)) {
+        throw std::out_of_range("Node out of range");
+    }
+    return levelData(level)[index];
+}
+
+template <typename HashPolicy>
+std::vector<Digest> BasicKaryMerkleTree<HashPolicy>::generateProof(size_t index) const {
+    if (index >= numLeaves) {
+        throw std::out_of_range("Index out of range");
+    }
+    MERKLE_PHASE(Phase::ProofGeneration);
+
+    std::vector<Digest> proof;
+    proof.reserve((arity - 1) * (getLevelCount() - 1));
+    for (size_t level = 0; level + 1 < getLevelCount(); level++) {
+        const Digest* row = levelData(level);
+        size_t first = index / arity * arity;
+        size_t last = std::min(first + arity, levelSize(level));
+        for (size_t c = first; c < last; c++) {
+            if (c != index && last - first > 1) {
+                proof.push_back(row[c]);
+            }
+        }
+        index /= arity;
+    }
+    return proof;
+}
+
+template <typename HashPolicy>
+bool BasicKaryMerkleTree<HashPolicy>::verifyProof(const Digest& rootHash,
+                                                  std::span<const byte> data,
+                                                  std::span<const Digest> proof,
+                                                  size_t index,
+                                                  size_t totalLeaves,
+                                                  size_t arity) {
+    checkArity(arity);
+    if (index >= totalLeaves) {
+        return false;
+    }
+    MERKLE_PHASE(Phase::Verification);
+
+    Digest current = HashPolicy::leaf(data.data(), data.size());
+    Digest children[MAX_ARITY];
+    size_t proofPos = 0;
+
+    for (size_t nodesInLevel = totalLeaves; nodesInLevel > 1; nodesInLevel = (nodesInLevel + arity - 1) / arity) {
+        size_t first = index / arity * arity;
+        size_t childCount = std::min(arity, nodesInLevel - first);
+        if (childCount > 1) {
+            if (proof.size() - proofPos < childCount - 1) {
+                return false;
+            }
+            for (size_t c = 0; c < childCount; c++) {
+                children[c] = first + c == index ? current : proof[proofPos++];
+            }
+            current = nodeDigest<HashPolicy>(children, childCount);
+        }
+        index /= arity;
+    }
+
+    return proofPos == proof.size() && current == rootHash;
+}
+
+template <typename HashPolicy>
+ProofBitmap BasicKaryMerkleTree<HashPolicy>::verifyBatch(const Digest& rootHash,
+                                                         std::span<const ProofCheck> checks,
+                                                         size_t totalLeaves,
+                                                         size_t arity,
+                                                         ThreadPool* pool) {
+    checkArity(arity);
+    MERKLE_PHASE(Phase::Verification);
+    return verifyInGroups(checks.size(), pool, [&](size_t start, size_t count, bool* results) {
+        verifyGroup<HashPolicy>(rootHash, &checks[start], count, totalLeaves, arity, results);
+    });
+}
+
+template class BasicKaryMerkleTree<Sha256Policy>;
+template class BasicKaryMerkleTree<Blake3Policy>;
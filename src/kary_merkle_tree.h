@@ -0,0 +1,99 @@
+// kary_merkle_tree.h
+#ifndef KARY_MERKLE_TREE_H
+#define KARY_MERKLE_TREE_H
+
+#include "hash.h"
+#include "hash_policy.h"
+#include "merkle_tree.h"
+#include <span>
+#include <vector>
+
+class ThreadPool;
+
+// A Merkle tree whose internal nodes have up to arity children (2, 4, 8 or
+// 16). A node's digest is HashPolicy::leaf() over its children's digests
+// concatenated in order, one multi-block hash. The last node of a level
+// takes the children that are left; a node with a single child carries it up
+// unchanged, as MerkleTree does.
+//
+// Arity 2 is byte-compatible with MerkleTree: the same roots and the same
+// proofs. Wider nodes make the tree log2(arity) times shallower, so a proof
+// is verified in fewer, longer sequential hashes, at the price of arity - 1
+// siblings per level instead of one.
+template <typename HashPolicy = Sha256Policy>
+class BasicKaryMerkleTree {
+    static_assert(HashPolicy::digestSize == sizeof(Digest), "node storage holds fixed 32-byte digests");
+
+public:
+    static constexpr size_t MAX_ARITY = 16;
+
+    // Throws std::invalid_argument for empty data or an unsupported arity.
+    BasicKaryMerkleTree(const std::vector<ByteArray>& data, size_t arity);
+
+    // Leaves and then each level are hashed in parallel on pool.
+    BasicKaryMerkleTree(const std::vector<ByteArray>& data, size_t arity, ThreadPool& pool);
+
+    ByteArray getRootHash() const;
+
+    size_t getArity() const { return arity; }
+
+    size_t getLeafCount() const { return numLeaves; }
+
+    size_t getLevelCount() const { return levelOffsets.size() - 1; }
+
+    size_t getLevelSize(size_t level) const { return levelSize(level); }
+
+    // Throws std::out_of_range outside the tree.
+    const Digest& getNodeHash(size_t level, size_t index) const;
+
+    // Siblings bottom-up: on each level, the other children of the path's
+    // node in child order. Throws std::out_of_range for a bad index.
+    std::vector<Digest> generateProof(size_t index) const;
+
+    // Throws std::invalid_argument for an unsupported arity.
+    static bool verifyProof(const Digest& rootHash,
+                            std::span<const byte> data,
+                            std::span<const Digest> proof,
+                            size_t index,
+                            size_t totalLeaves,
+                            size_t arity);
+
+    // Verifies independent proofs in lockstep groups of 16, so every level of
+    // a group is one multi-lane hash call; groups are spread over pool when
+    // one is given.
+    static ProofBitmap verifyBatch(const Digest& rootHash,
+                                   std::span<const ProofCheck> checks,
+                                   size_t totalLeaves,
+                                   size_t arity,
+                                   ThreadPool* pool = nullptr);
+
+private:
+    // Level-by-level digest storage as in MerkleTree: level h holds
+    // ceil(n / arity^h) nodes and node i's parent is node i / arity.
+    std::vector<Digest> nodes;
+    std::vector<size_t> levelOffsets;
+
+    size_t numLeaves;
+    size_t arity;
+    size_t arityBits;
+
+    void allocateLevels(size_t leafCount, size_t treeArity);
+
+    // Computes nodes [begin, end) of level from the level below it.
+    void buildLevel(size_t level, size_t begin, size_t end);
+
+    const Digest* levelData(size_t level) const {
+        return nodes.data() + levelOffsets[level];
+    }
+
+    size_t levelSize(size_t level) const {
+        return ((numLeaves - 1) >> (arityBits * level)) + 1;
+    }
+};
+
+typedef BasicKaryMerkleTree<Sha256Policy> KaryMerkleTree;
+
+extern template class BasicKaryMerkleTree<Sha256Policy>;
+extern template class BasicKaryMerkleTree<Blake3Policy>;
+
+#endif // KARY_MERKLE_TREE_H
@@ -0,0 +1,170 @@
+// leaf_index.cpp
+#include "leaf_index.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const size_t MIN_CAPACITY = 16;
+
+// Slots for count distinct digests at no more than 3/4 load.
+size_t capacityFor(size_t count) {
+    return std::max(MIN_CAPACITY, std::bit_ceil(count + count / 3 + 1));
+}
+
+} // namespace
+
+void LeafIndex::build(const Digest* leaves, size_t count) {
+    if (count >= MAX_LEAVES) {
+        throw std::invalid_argument("Leaf index holds at most 2^32 - 2 leaves.");
+    }
+    slots.assign(capacityFor(count), EMPTY);
+    duplicates.clear();
+    used = 0;
+    for (size_t position = 0; position < count; position++) {
+        insert(leaves, position);
+    }
+}
+
+size_t LeafIndex::bucketOf(const Digest& digest) const {
+    uint64_t prefix;
+    std::memcpy(&prefix, digest.data(), sizeof(prefix));
+    return prefix & (slots.size() - 1);
+}
+
+size_t LeafIndex::probe(const Digest* leaves, const Digest& digest) const {
+    size_t mask = slots.size() - 1;
+    size_t slot = bucketOf(digest);
+    while (slots[slot] != EMPTY && leaves[slots[slot]] != digest) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void LeafIndex::insert(const Digest* leaves, size_t position) {
+    if (position >= MAX_LEAVES) {
+        throw std::invalid_argument("Leaf index holds at most 2^32 - 2 leaves.");
+    }
+    if (slots.empty() || 4 * (used + 1) > 3 * slots.size()) {
+        rehash(leaves, capacityFor(used + 1));
+    }
+
+    size_t slot = probe(leaves, leaves[position]);
+    if (slots[slot] == EMPTY) {
+        slots[slot] = uint32_t(position);
+        used++;
+        return;
+    }
+
+    // The slot keeps the lowest position, so a lookup's first answer is
+    // always the first occurrence.
+    uint32_t first = slots[slot];
+    if (position < first) {
+        std::vector<uint32_t> rest;
+        auto it = duplicates.find(first);
+        if (it != duplicates.end()) {
+            rest = std::move(it->second);
+            duplicates.erase(it);
+        }
+        rest.push_back(first);
+        slots[slot] = uint32_t(position);
+        duplicates[uint32_t(position)] = std::move(rest);
+    } else {
+        duplicates[first].push_back(uint32_t(position));
+    }
+}
+
+void LeafIndex::erase(const Digest* leaves, size_t position) {
+    if (slots.empty()) {
+        return;
+    }
+    size_t slot = probe(leaves, leaves[position]);
+    if (slots[slot] == EMPTY) {
+        return;
+    }
+
+    uint32_t first = slots[slot];
+    auto it = duplicates.find(first);
+    if (position != first) {
+        if (it != duplicates.end()) {
+            std::erase(it->second, uint32_t(position));
+            if (it->second.empty()) {
+                duplicates.erase(it);
+            }
+        }
+        return;
+    }
+    if (it != duplicates.end()) {
+        // The lowest remaining duplicate takes over the slot.
+        std::vector<uint32_t> rest = std::move(it->second);
+        duplicates.erase(it);
+        auto lowest = std::min_element(rest.begin(), rest.end());
+        slots[slot] = *lowest;
+        rest.erase(lowest);
+        if (!rest.empty()) {
+            duplicates[slots[slot]] = std::move(rest);
+        }
+        return;
+    }
+
+    // Backward-shift deletion: later entries of the run move into the hole
+    // when the hole lies between their bucket and their slot, so every probe
+    // sequence stays unbroken without tombstones.
+    size_t mask = slots.size() - 1;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; slots[next] != EMPTY; next = (next + 1) & mask) {
+        size_t home = bucketOf(leaves[slots[next]]);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+    }
+    slots[hole] = EMPTY;
+    used--;
+}
+
+std::vector<size_t> LeafIndex::find(const Digest* leaves, const Digest& digest) const {
+    std::vector<size_t> positions;
+    if (slots.empty()) {
+        return positions;
+    }
+    size_t slot = probe(leaves, digest);
+    if (slots[slot] == EMPTY) {
+        return positions;
+    }
+    positions.push_back(slots[slot]);
+    auto it = duplicates.find(slots[slot]);
+    if (it != duplicates.end()) {
+        positions.insert(positions.end(), it->second.begin(), it->second.end());
+        std::sort(positions.begin() + 1, positions.end());
+    }
+    return positions;
+}
+
+size_t LeafIndex::getMemoryUsage() const {
+    size_t bytes = slots.capacity() * sizeof(uint32_t);
+    for (const auto& entry : duplicates) {
+        // Key, list header and the hash node's own pointers.
+        bytes += sizeof(entry) + 2 * sizeof(void*) + entry.second.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+void LeafIndex::rehash(const Digest* leaves, size_t capacity) {
+    std::vector<uint32_t> old;
+    old.swap(slots);
+    slots.assign(capacity, EMPTY);
+    size_t mask = capacity - 1;
+    for (uint32_t position : old) {
+        if (position == EMPTY) {
+            continue;
+        }
+        size_t slot = bucketOf(leaves[position]);
+        while (slots[slot] != EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = position;
+    }
+}
@@ -0,0 +1,61 @@
+// leaf_index.h
+#ifndef LEAF_INDEX_H
+#define LEAF_INDEX_H
+
+#include "hash.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Maps leaf digests to the positions that hold them, for finding a leaf by
+// its value without a scan.
+//
+// The table is open-addressed with linear probing and stores nothing but
+// 32-bit positions: the digest of a slot is read back from the leaf level it
+// indexes, and its leading bytes, already uniformly distributed, pick the
+// bucket. At most 3/4 full, that is 5.3 to 10.7 bytes per distinct leaf.
+// A slot holds the first position of its digest; further positions of a
+// repeated digest are kept on the side, so duplicates never lengthen the
+// probe sequences of other digests.
+//
+// Every call takes the indexed leaf digests, which may move between calls
+// (e.g. when the tree grows); leaves[p] must hold the digest position p was
+// indexed under.
+class LeafIndex {
+public:
+    // Positions must stay below this.
+    static constexpr size_t MAX_LEAVES = UINT32_MAX;
+
+    // Indexes leaves [0, count). Throws std::invalid_argument beyond MAX_LEAVES.
+    void build(const Digest* leaves, size_t count);
+
+    void insert(const Digest* leaves, size_t position);
+
+    // Call before leaves[position] changes.
+    void erase(const Digest* leaves, size_t position);
+
+    // Every position holding digest, in ascending order.
+    std::vector<size_t> find(const Digest* leaves, const Digest& digest) const;
+
+    // Bytes held by the table and the duplicate lists.
+    size_t getMemoryUsage() const;
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    std::vector<uint32_t> slots;
+
+    // Positions after the first, keyed by the first.
+    std::unordered_map<uint32_t, std::vector<uint32_t>> duplicates;
+
+    size_t used = 0;
+
+    size_t bucketOf(const Digest& digest) const;
+
+    // The slot holding digest, or the empty slot that ends its probe sequence.
+    size_t probe(const Digest* leaves, const Digest& digest) const;
+
+    void rehash(const Digest* leaves, size_t capacity);
+};
+
+#endif // LEAF_INDEX_H
@@ -0,0 +1,264 @@
+// leaf_input.cpp
+#include "leaf_input.h"
+#include "hash_policy.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Chunks of a mapped range requested ahead of the one being hashed.
+const size_t READ_AHEAD_CHUNKS = 4;
+
+// A reader leaf shorter than this is hashed in one call without a helper
+// thread.
+const size_t SMALL_LEAF_SIZE = 64 * 1024;
+
+// In-memory leaves handed to one leafBatch call.
+const size_t BATCH_LEAVES = 256;
+
+class FileDescriptor {
+public:
+    explicit FileDescriptor(const std::string& path) : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open leaf file " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    ~FileDescriptor() { ::close(fd); }
+
+    FileDescriptor(const FileDescriptor&) = delete;
+    FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+    int get() const { return fd; }
+
+private:
+    int fd;
+};
+
+// Fills buffer from reader until it is full or the leaf ends.
+size_t fill(LeafReader& reader, byte* buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        size_t n = reader.read(buffer + done, size - done);
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// Reads a leaf into two alternating buffers on a helper thread, so the next
+// chunk is read while the caller hashes the current one.
+class ReadAhead {
+public:
+    explicit ReadAhead(LeafReader& reader) : reader(reader) {
+        for (Slot& slot : slots) {
+            slot.buffer.resize(STREAM_CHUNK_SIZE);
+        }
+        thread = std::thread([this] { produce(); });
+    }
+
+    ~ReadAhead() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+    }
+
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    // The next chunk, valid until the following call; empty at the end.
+    LeafSpan next() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (holding) {
+            slots[current].full = false;
+            current ^= 1;
+            changed.notify_all();
+        }
+        changed.wait(lock, [this] { return slots[current].full || error; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        holding = true;
+        return LeafSpan(slots[current].buffer.data(), slots[current].size);
+    }
+
+private:
+    struct Slot {
+        std::vector<byte> buffer;
+        size_t size = 0;
+        bool full = false;
+    };
+
+    LeafReader& reader;
+    Slot slots[2];
+    size_t current = 0;
+    bool holding = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+
+    void produce() {
+        for (size_t index = 0; ; index ^= 1) {
+            Slot& slot = slots[index];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !slot.full || stopping; });
+                if (stopping) {
+                    return;
+                }
+            }
+
+            size_t size;
+            try {
+                size = fill(reader, slot.buffer.data(), slot.buffer.size());
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                error = std::current_exception();
+                changed.notify_all();
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.size = size;
+            slot.full = true;
+            changed.notify_all();
+            if (size == 0) {
+                return;
+            }
+        }
+    }
+};
+
+template <typename HashPolicy>
+Digest hashReader(LeafReader& reader) {
+    // Most leaves are small; only longer ones get a read-ahead thread.
+    std::vector<byte> first(SMALL_LEAF_SIZE);
+    size_t size = fill(reader, first.data(), first.size());
+    if (size < first.size()) {
+        return HashPolicy::leaf(first.data(), size);
+    }
+
+    typename HashPolicy::Stream stream;
+    ReadAhead ahead(reader);
+    stream.update(first.data(), size);
+    for (LeafSpan chunk = ahead.next(); !chunk.empty(); chunk = ahead.next()) {
+        stream.update(chunk.data(), chunk.size());
+    }
+    return stream.finish();
+}
+
+template <typename HashPolicy>
+Digest hashRange(const FileRange& range) {
+    FileDescriptor file(range.path);
+    struct stat status;
+    if (::fstat(file.get(), &status) < 0) {
+        throw std::runtime_error("Cannot stat leaf file " + range.path + ": " + std::strerror(errno));
+    }
+    uint64_t fileSize = status.st_size;
+    if (range.offset > fileSize || (range.length != FileRange::TO_END && range.length > fileSize - range.offset)) {
+        throw std::out_of_range("Leaf range lies outside " + range.path);
+    }
+    uint64_t length = range.length == FileRange::TO_END ? fileSize - range.offset : range.length;
+    if (length == 0) {
+        static const byte empty = 0;
+        return HashPolicy::leaf(&empty, 0);
+    }
+
+    // Mappings start on a page boundary.
+    uint64_t pageSize = ::sysconf(_SC_PAGESIZE);
+    uint64_t mapOffset = range.offset - range.offset % pageSize;
+    size_t mapLength = length + (range.offset - mapOffset);
+    void* address = ::mmap(nullptr, mapLength, PROT_READ, MAP_PRIVATE, file.get(), off_t(mapOffset));
+    if (address == MAP_FAILED) {
+        throw std::runtime_error("Cannot map leaf file " + range.path + ": " + std::strerror(errno));
+    }
+    byte* base = static_cast<byte*>(address);
+    const byte* data = base + (range.offset - mapOffset);
+    ::madvise(base, mapLength, MADV_SEQUENTIAL);
+
+    if (length <= STREAM_CHUNK_SIZE) {
+        Digest digest = HashPolicy::leaf(data, length);
+        ::munmap(address, mapLength);
+        return digest;
+    }
+
+    // Page-aligned chunks, so hints can be given for exactly the chunk's pages.
+    typename HashPolicy::Stream stream;
+    size_t chunk = STREAM_CHUNK_SIZE;
+    for (size_t begin = 0; begin < mapLength; begin += chunk) {
+        size_t aheadBegin = begin + chunk;
+        if (aheadBegin < mapLength) {
+            size_t aheadLength = std::min(mapLength - aheadBegin, READ_AHEAD_CHUNKS * chunk);
+            ::madvise(base + aheadBegin, aheadLength, MADV_WILLNEED);
+        }
+
+        size_t end = std::min(mapLength, begin + chunk);
+        size_t skip = begin == 0 ? range.offset - mapOffset : 0;
+        stream.update(base + begin + skip, end - begin - skip);
+
+        // Hashed pages stay in the page cache but leave this process.
+        ::madvise(base + begin, end - begin, MADV_DONTNEED);
+    }
+    ::munmap(address, mapLength);
+    return stream.finish();
+}
+
+} // namespace
+
+template <typename HashPolicy>
+Digest hashLeaf(const LeafInput& leaf) {
+    if (leaf.inMemory()) {
+        LeafSpan bytes = leaf.getBytes();
+        return HashPolicy::leaf(bytes.data(), bytes.size());
+    }
+    if (leaf.isRange()) {
+        return hashRange<HashPolicy>(leaf.getRange());
+    }
+    return hashReader<HashPolicy>(leaf.getReader());
+}
+
+template <typename HashPolicy>
+void hashLeaves(const LeafInput* leaves, size_t count, Digest* output) {
+    const byte* messages[BATCH_LEAVES];
+    size_t sizes[BATCH_LEAVES];
+
+    size_t i = 0;
+    while (i < count) {
+        if (!leaves[i].inMemory()) {
+            output[i] = hashLeaf<HashPolicy>(leaves[i]);
+            i++;
+            continue;
+        }
+
+        size_t first = i;
+        for (; i < count && i - first < BATCH_LEAVES && leaves[i].inMemory(); i++) {
+            LeafSpan bytes = leaves[i].getBytes();
+            messages[i - first] = bytes.data();
+            sizes[i - first] = bytes.size();
+        }
+        HashPolicy::leafBatch(messages, sizes, output + first, i - first);
+    }
+}
+
+template Digest hashLeaf<Sha256Policy>(const LeafInput&);
+template Digest hashLeaf<Blake3Policy>(const LeafInput&);
+template void hashLeaves<Sha256Policy>(const LeafInput*, size_t, Digest*);
+template void hashLeaves<Blake3Policy>(const LeafInput*, size_t, Digest*);
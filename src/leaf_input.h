@@ -0,0 +1,89 @@
+// leaf_input.h
+#ifndef LEAF_INPUT_H
+#define LEAF_INPUT_H
+
+#include "hash.h"
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <variant>
+
+typedef std::span<const byte> LeafSpan;
+
+inline LeafSpan asLeaf(std::string_view text) {
+    return LeafSpan(reinterpret_cast<const byte*>(text.data()), text.size());
+}
+
+// Produces one leaf's bytes in order, for payloads generated on the fly or
+// too large to hold in memory.
+class LeafReader {
+public:
+    virtual ~LeafReader() = default;
+
+    // Writes up to size bytes to out and returns how many; 0 ends the leaf.
+    // Failures are reported by throwing.
+    virtual size_t read(byte* out, size_t size) = 0;
+};
+
+// Bytes [offset, offset + length) of a file; TO_END runs to its end.
+struct FileRange {
+    static constexpr uint64_t TO_END = UINT64_MAX;
+
+    std::string path;
+    uint64_t offset = 0;
+    uint64_t length = TO_END;
+};
+
+// One leaf as the tree takes it, never copied: a view of caller memory, which
+// must stay valid while it is hashed; a file range, hashed through a mapping;
+// or a reader, drained once. Many small records of one file are best mapped
+// once (MappedFile) and passed as views rather than as ranges.
+class LeafInput {
+public:
+    LeafInput(LeafSpan bytes) : source(bytes) {}
+    LeafInput(const ByteArray& bytes) : source(LeafSpan(bytes)) {}
+    LeafInput(const std::string& text) : source(asLeaf(text)) {}
+    LeafInput(std::string_view text) : source(asLeaf(text)) {}
+    LeafInput(const char* text) : source(asLeaf(text)) {}
+    LeafInput(FileRange range) : source(std::move(range)) {}
+
+    template <std::derived_from<LeafReader> Reader>
+    LeafInput(std::shared_ptr<Reader> reader) : source(std::shared_ptr<LeafReader>(std::move(reader))) {}
+
+    // A view of a temporary would dangle once the full expression ends.
+    LeafInput(ByteArray&&) = delete;
+    LeafInput(std::string&&) = delete;
+
+    bool inMemory() const { return std::holds_alternative<LeafSpan>(source); }
+
+    bool isRange() const { return std::holds_alternative<FileRange>(source); }
+
+    // Only valid for the matching kind of leaf.
+    LeafSpan getBytes() const { return std::get<LeafSpan>(source); }
+    const FileRange& getRange() const { return std::get<FileRange>(source); }
+    LeafReader& getReader() const { return *std::get<std::shared_ptr<LeafReader>>(source); }
+
+private:
+    std::variant<LeafSpan, FileRange, std::shared_ptr<LeafReader>> source;
+};
+
+// Files and readers are hashed in pieces of this size. The next piece is
+// fetched while the current one is hashed: mapped ranges ask the kernel to
+// read it ahead, readers fill it on a helper thread.
+const size_t STREAM_CHUNK_SIZE = 1 << 20;
+
+// Digest of one leaf, equal to HashPolicy::leaf() over its bytes. Throws
+// std::runtime_error if a file cannot be read and std::out_of_range if a
+// range lies outside its file.
+template <typename HashPolicy>
+Digest hashLeaf(const LeafInput& leaf);
+
+// hashLeaf() for count leaves. Runs of in-memory leaves are hashed together
+// by the policy's multi-lane kernels.
+template <typename HashPolicy>
+void hashLeaves(const LeafInput* leaves, size_t count, Digest* output);
+
+#endif // LEAF_INPUT_H
@@ -1,5 +1,6 @@
 // main.cpp - Enhanced version in English
 #include "merkle_tree.h"
+#include "proof_format.h"
 #include <iostream>
 #include <string>
 #include <vector>
@@ -124,6 +125,10 @@ std::vector<ByteArray> generateAndShowProof(const MerkleTree& tree, size_t index
     }
 
     std::cout << "\nThe proof size is " << proof.size() * 32 << " bytes, rather than the size of the entire dataset.\n";
+    ByteArray encoded(encodedProofSize(proof.size()));
+    tree.encodeProof(index, encoded);
+    std::cout << "Encoded for transmission it takes " << encoded.size() << " bytes: a " << sizeof(ProofHeader)
+              << "-byte header with the index and tree size, then the packed hashes.\n";
     std::cout << "This demonstrates the succinctness of Merkle Tree proofs - O(log n) where n is the number of data items.\n";
     sleep(1000);
 
@@ -268,27 +273,30 @@ void showMenu() {
                 customData.push_back(stringToBytes(item));
             }
 
-            // Build tree and show root hash
+            // Build tree, index its leaves and show root hash
             MerkleTree customTree(customData);
+            customTree.buildLeafIndex();
             ByteArray customRootHash = customTree.getRootHash();
             std::cout << "\nCustom Merkle Tree root hash: " << bytesToHexString(customRootHash) << std::endl;
 
-            // Choose index to generate proof
-            size_t customIndex;
-            std::cout << "\nEnter index of data item to prove (0-" << customData.size() - 1 << "): ";
-            std::cin >> customIndex;
+            // Look the item up by value, so its index need not be known
+            std::string customItem;
+            std::cout << "\nEnter data item to prove: ";
+            std::getline(std::cin, customItem);
+            ByteArray customLeaf = stringToBytes(customItem);
 
-            if (customIndex >= customData.size()) {
-                std::cout << "\nError: Index out of range!" << std::endl;
+            if (customTree.findLeaf(customLeaf).empty()) {
+                std::cout << "\nError: Data item not in the tree!" << std::endl;
                 break;
             }
 
             // Generate and verify proof
-            std::vector<ByteArray> customProof = customTree.generateProof(customIndex);
-            std::cout << "\nProof generation successful! Contains " << customProof.size() << " hash values." << std::endl;
+            LeafProof customProof = customTree.generateProofFor(customLeaf);
+            std::cout << "\nFound at index " << customProof.index << ". Proof generation successful! Contains "
+                      << customProof.proof.size() << " hash values." << std::endl;
 
-            bool isCustomValid = MerkleTree::verifyProof(customRootHash, customData[customIndex],
-                                                         customProof, customIndex, customData.size());
+            bool isCustomValid = MerkleTree::verifyProof(customRootHash, customLeaf, customProof.proof,
+                                                         customProof.index, customData.size());
             if (isCustomValid) {
                 std::cout << "\n✓ Proof verified successfully!" << std::endl;
             } else {
@@ -0,0 +1,44 @@
+// mapped_file.cpp
+#include "mapped_file.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        int error = errno;
+        ::close(fd);
+        throw std::runtime_error("Cannot stat " + path + ": " + std::strerror(error));
+    }
+
+    size_t length = static_cast<size_t>(info.st_size);
+    void* address = nullptr;
+    if (length > 0) {
+        address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            int error = errno;
+            ::close(fd);
+            throw std::runtime_error("Cannot map " + path + ": " + std::strerror(error));
+        }
+    }
+    // The mapping keeps the file referenced after the descriptor is closed.
+    ::close(fd);
+
+    return std::shared_ptr<MappedFile>(new MappedFile(static_cast<const byte*>(address), length));
+}
+
+MappedFile::~MappedFile() {
+    if (address != nullptr) {
+        munmap(const_cast<byte*>(address), length);
+    }
+}
@@ -0,0 +1,29 @@
+// mapped_file.h
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "hash.h"
+#include <memory>
+#include <string>
+
+// Read-only memory mapping of a whole file, unmapped when the last owner goes.
+class MappedFile {
+public:
+    static std::shared_ptr<MappedFile> open(const std::string& path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const byte* data() const { return address; }
+    size_t size() const { return length; }
+
+private:
+    MappedFile(const byte* address, size_t length) : address(address), length(length) {}
+
+    const byte* address;
+    size_t length;
+};
+
+#endif // MAPPED_FILE_H
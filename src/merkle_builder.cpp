@@ -0,0 +1,146 @@
+// merkle_builder.cpp
+#include "merkle_builder.h"
+#include "hash_policy.h"
+#include <stdexcept>
+#include <string>
+
+MerkleTreeBuilder::MerkleTreeBuilder() : MerkleTreeBuilder(NodeSink()) {}
+
+MerkleTreeBuilder::MerkleTreeBuilder(NodeSink sink)
+    : sink(std::move(sink)), numLeaves(0), finished(false) {
+    chunk.reserve(CHUNK_LEAVES);
+}
+
+void MerkleTreeBuilder::addLeaf(const ByteArray& data) {
+    addLeaf(data.data(), data.size());
+}
+
+void MerkleTreeBuilder::addLeaf(const byte* data, size_t size) {
+    addLeafHash(sha256Digest(data, size));
+}
+
+void MerkleTreeBuilder::addLeaf(const LeafInput& leaf) {
+    addLeafHash(hashLeaf<Sha256Policy>(leaf));
+}
+
+void MerkleTreeBuilder::addLeafHash(const Digest& leafHash) {
+    if (finished) {
+        throw std::logic_error("Cannot add leaves after finish().");
+    }
+
+    chunk.push_back(leafHash);
+    numLeaves++;
+    if (chunk.size() == CHUNK_LEAVES) {
+        flushChunk();
+    }
+}
+
+void MerkleTreeBuilder::addLines(std::istream& in) {
+    std::string line;
+    while (std::getline(in, line)) {
+        addLeaf(reinterpret_cast<const byte*>(line.data()), line.size());
+    }
+}
+
+void MerkleTreeBuilder::addRecords(std::istream& in, size_t recordSize) {
+    if (recordSize == 0) {
+        throw std::invalid_argument("Record size must be positive.");
+    }
+
+    ByteArray record(recordSize);
+    while (in.read(reinterpret_cast<char*>(record.data()), recordSize) || in.gcount() > 0) {
+        addLeaf(record.data(), static_cast<size_t>(in.gcount()));
+    }
+}
+
+void MerkleTreeBuilder::flushChunk() {
+    // A full chunk is a perfect subtree, so no node inside it is carried up.
+    for (size_t i = 0; i < chunk.size(); i++) {
+        emit(0, chunk[i]);
+    }
+    for (size_t level = 1; level <= CHUNK_LEVEL; level++) {
+        chunkParents.resize(chunk.size() / 2);
+        hashPairs(chunk.data(), chunkParents.data(), chunkParents.size());
+        chunk.swap(chunkParents);
+        for (const Digest& digest : chunk) {
+            emit(level, digest);
+        }
+    }
+
+    Digest chunkRoot = chunk[0];
+    chunk.clear();
+
+    frontier.resize(std::max(frontier.size(), CHUNK_LEVEL + 1));
+    if (frontier[CHUNK_LEVEL]) {
+        Digest left = *frontier[CHUNK_LEVEL];
+        frontier[CHUNK_LEVEL].reset();
+        pushNode(CHUNK_LEVEL + 1, hashPair(left, chunkRoot));
+    } else {
+        frontier[CHUNK_LEVEL] = chunkRoot;
+    }
+}
+
+void MerkleTreeBuilder::pushNode(size_t level, Digest digest) {
+    emit(level, digest);
+    while (true) {
+        if (frontier.size() <= level) {
+            frontier.resize(level + 1);
+        }
+        if (!frontier[level]) {
+            frontier[level] = digest;
+            return;
+        }
+        digest = hashPair(*frontier[level], digest);
+        frontier[level].reset();
+        level++;
+        emit(level, digest);
+    }
+}
+
+void MerkleTreeBuilder::emit(size_t level, const Digest& digest) {
+    if (levelCounts.size() <= level) {
+        levelCounts.resize(level + 1, 0);
+    }
+    size_t index = levelCounts[level]++;
+    if (sink) {
+        sink(level, index, digest);
+    }
+}
+
+ByteArray MerkleTreeBuilder::finish() {
+    if (finished) {
+        throw std::logic_error("finish() was already called.");
+    }
+    if (numLeaves == 0) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+    finished = true;
+
+    // The slots below CHUNK_LEVEL are empty here, so the partial chunk can be
+    // merged one leaf at a time.
+    for (const Digest& leafHash : chunk) {
+        pushNode(0, leafHash);
+    }
+    chunk.clear();
+
+    size_t rootLevel = 0;
+    while (((numLeaves - 1) >> rootLevel) > 0) {
+        rootLevel++;
+    }
+
+    // Close the right edge bottom-up. A waiting left node pairs with whatever
+    // is carried up from below; on its own it becomes the carried node.
+    std::optional<Digest> carry;
+    for (size_t level = 0; level < frontier.size(); level++) {
+        if (frontier[level] && carry) {
+            carry = hashPair(*frontier[level], *carry);
+        } else if (frontier[level]) {
+            carry = frontier[level];
+        }
+        if (carry && level + 1 <= rootLevel) {
+            emit(level + 1, *carry);
+        }
+    }
+
+    return digestToBytes(*carry);
+}
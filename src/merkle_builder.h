@@ -0,0 +1,77 @@
+// merkle_builder.h
+#ifndef MERKLE_BUILDER_H
+#define MERKLE_BUILDER_H
+
+#include "hash.h"
+#include "leaf_input.h"
+#include <functional>
+#include <istream>
+#include <optional>
+#include <vector>
+
+// Builds the same tree as MerkleTree without holding the leaves. Leaves are fed
+// one at a time and only the frontier of unpaired subtree roots (one per level)
+// plus a chunk of recent leaf hashes is kept, so memory stays O(log n).
+class MerkleTreeBuilder {
+public:
+    // Receives every node exactly as MerkleTree stores it, including the copies
+    // of carried-up nodes. Calls for one level arrive in index order.
+    typedef std::function<void(size_t level, size_t index, const Digest& digest)> NodeSink;
+
+    MerkleTreeBuilder();
+    explicit MerkleTreeBuilder(NodeSink sink);
+
+    void addLeaf(const ByteArray& data);
+    void addLeaf(const byte* data, size_t size);
+
+    // A viewed, mapped or streamed leaf (leaf_input.h). Large leaves are
+    // hashed in chunks, so a builder over multi-GB files stays small.
+    void addLeaf(const LeafInput& leaf);
+
+    // Adds a leaf whose commitment was computed elsewhere.
+    void addLeafHash(const Digest& leafHash);
+
+    template <typename Iterator>
+    void addLeaves(Iterator first, Iterator last) {
+        for (; first != last; ++first) {
+            addLeaf(*first);
+        }
+    }
+
+    // One leaf per line, without the line terminator (e.g. a file or std::cin).
+    void addLines(std::istream& in);
+
+    // Fixed-size records; a shorter final record becomes the last leaf.
+    void addRecords(std::istream& in, size_t recordSize);
+
+    // Completes the carried-up right edge and returns the root. The builder
+    // cannot take more leaves afterwards.
+    ByteArray finish();
+
+    size_t getLeafCount() const { return numLeaves; }
+
+private:
+    // Leaf hashes are collected into chunks of 2^CHUNK_LEVEL and each full
+    // chunk's levels are hashed with the batch kernel before joining the frontier.
+    static constexpr size_t CHUNK_LEVEL = 10;
+    static constexpr size_t CHUNK_LEAVES = size_t(1) << CHUNK_LEVEL;
+
+    NodeSink sink;
+    std::vector<Digest> chunk;
+    std::vector<Digest> chunkParents;
+
+    // frontier[h] is a complete level-h node still waiting for its right sibling.
+    std::vector<std::optional<Digest>> frontier;
+
+    // Nodes emitted so far on each level, i.e. the index of the next one.
+    std::vector<size_t> levelCounts;
+
+    size_t numLeaves;
+    bool finished;
+
+    void flushChunk();
+    void pushNode(size_t level, Digest digest);
+    void emit(size_t level, const Digest& digest);
+};
+
+#endif // MERKLE_BUILDER_H
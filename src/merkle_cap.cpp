@@ -0,0 +1,179 @@
+// merkle_cap.cpp
+#include "merkle_cap.h"
+#include "stats.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+size_t levelSizeOf(size_t leafCount, size_t level) {
+    return ((leafCount - 1) >> level) + 1;
+}
+
+} // namespace
+
+template <typename HashPolicy>
+BasicMerkleCap<HashPolicy>::BasicMerkleCap(const Digest& rootHash, size_t totalLeaves, size_t capLevel,
+                                           std::vector<Digest> cap)
+    : numLeaves(totalLeaves), capLevel(capLevel) {
+    if (totalLeaves == 0) {
+        throw std::invalid_argument("Cannot cap an empty tree.");
+    }
+    if (capLevel >= 64 || (capLevel > 0 && ((totalLeaves - 1) >> (capLevel - 1)) == 0)) {
+        throw std::invalid_argument("Cap level is above the root.");
+    }
+    if (cap.size() != levelSizeOf(totalLeaves, capLevel)) {
+        throw std::invalid_argument("Cap has " + std::to_string(cap.size()) + " entries, expected " +
+                                    std::to_string(levelSizeOf(totalLeaves, capLevel)));
+    }
+
+    MERKLE_PHASE(Phase::Verification);
+    levels.push_back(std::move(cap));
+    while (levels.back().size() > 1) {
+        const std::vector<Digest>& children = levels.back();
+        std::vector<Digest> parents((children.size() + 1) / 2);
+        HashPolicy::combineBatch(children.data(), parents.data(), children.size() / 2);
+        if (children.size() % 2 == 1) {
+            parents.back() = children.back();
+        }
+        levels.push_back(std::move(parents));
+    }
+
+    if (levels.back()[0] != rootHash) {
+        throw std::invalid_argument("Cap does not hash to the root.");
+    }
+}
+
+template <typename HashPolicy>
+bool BasicMerkleCap<HashPolicy>::verifyProof(std::span<const byte> data, std::span<const Digest> proof,
+                                             size_t index) const {
+    if (index >= numLeaves) {
+        return false;
+    }
+    MERKLE_PHASE(Phase::Verification);
+
+    Digest current = HashPolicy::leaf(data.data(), data.size());
+    size_t proofPos = 0;
+    for (size_t level = 0; level < capLevel; level++) {
+        size_t position = index >> level;
+        if ((position ^ 1) >= levelSizeOf(numLeaves, level)) {
+            continue;
+        }
+        if (proofPos == proof.size()) {
+            return false;
+        }
+        const Digest& sibling = proof[proofPos++];
+        current = position & 1 ? HashPolicy::combine(sibling, current) : HashPolicy::combine(current, sibling);
+    }
+    return proofPos == proof.size() && current == levels[0][index >> capLevel];
+}
+
+template <typename HashPolicy>
+ProofBitmap BasicMerkleCap<HashPolicy>::verifyBatch(std::span<const ProofCheck> checks, ThreadPool* pool) const {
+    return BasicMerkleTree<HashPolicy>::verifyBatchToLevel(levels[0], capLevel, checks, numLeaves, pool);
+}
+
+template <typename HashPolicy>
+bool BasicMerkleCap<HashPolicy>::refresh(const Digest& newRoot, size_t newLeafCount,
+                                         std::span<const CapEntry> changes) {
+    if (newLeafCount < numLeaves) {
+        return false;
+    }
+    size_t oldCapSize = levels[0].size();
+    size_t newCapSize = levelSizeOf(newLeafCount, capLevel);
+
+    std::vector<size_t> dirty;
+    dirty.reserve(changes.size());
+    for (const CapEntry& change : changes) {
+        if (change.index >= newCapSize) {
+            return false;
+        }
+        dirty.push_back(change.index);
+    }
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    size_t added = dirty.end() - std::lower_bound(dirty.begin(), dirty.end(), oldCapSize);
+    if (added != newCapSize - oldCapSize) {
+        return false;
+    }
+
+    MERKLE_PHASE(Phase::Verification);
+    std::vector<size_t> oldSizes;
+    for (const std::vector<Digest>& level : levels) {
+        oldSizes.push_back(level.size());
+    }
+    std::vector<Overwrite> undo;
+
+    // Grown levels get their new nodes from the rehash: each one is an
+    // ancestor of an added entry.
+    levels[0].resize(newCapSize);
+    size_t levelCount = 1;
+    while (levelSizeOf(newCapSize, levelCount - 1) > 1) {
+        levelCount++;
+    }
+    levels.resize(levelCount);
+    for (size_t level = 1; level < levelCount; level++) {
+        levels[level].resize(levelSizeOf(newCapSize, level));
+    }
+
+    for (const CapEntry& change : changes) {
+        undo.push_back({0, change.index, levels[0][change.index]});
+        levels[0][change.index] = change.digest;
+    }
+    rehashPaths(std::move(dirty), undo);
+
+    if (levels.back()[0] == newRoot) {
+        numLeaves = newLeafCount;
+        return true;
+    }
+
+    for (size_t i = undo.size(); i > 0; i--) {
+        const Overwrite& old = undo[i - 1];
+        levels[old.level][old.index] = old.digest;
+    }
+    levels.resize(oldSizes.size());
+    for (size_t level = 0; level < oldSizes.size(); level++) {
+        levels[level].resize(oldSizes[level]);
+    }
+    return false;
+}
+
+template <typename HashPolicy>
+void BasicMerkleCap<HashPolicy>::rehashPaths(std::vector<size_t> dirty, std::vector<Overwrite>& undo) {
+    std::vector<Digest> pairs;
+    std::vector<Digest> hashes;
+    std::vector<size_t> paired;
+
+    for (size_t level = 1; level < levels.size() && !dirty.empty(); level++) {
+        // Parents of a sorted list stay sorted, so duplicates are adjacent.
+        for (size_t& index : dirty) {
+            index /= 2;
+        }
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+        const std::vector<Digest>& children = levels[level - 1];
+        std::vector<Digest>& parents = levels[level];
+
+        pairs.clear();
+        paired.clear();
+        for (size_t parent : dirty) {
+            undo.push_back({level, parent, parents[parent]});
+            if (2 * parent + 1 < children.size()) {
+                pairs.push_back(children[2 * parent]);
+                pairs.push_back(children[2 * parent + 1]);
+                paired.push_back(parent);
+            } else {
+                parents[parent] = children[2 * parent];
+            }
+        }
+
+        hashes.resize(paired.size());
+        HashPolicy::combineBatch(pairs.data(), hashes.data(), paired.size());
+        for (size_t i = 0; i < paired.size(); i++) {
+            parents[paired[i]] = hashes[i];
+        }
+    }
+}
+
+template class BasicMerkleCap<Sha256Policy>;
+template class BasicMerkleCap<Blake3Policy>;
@@ -0,0 +1,80 @@
+// merkle_cap.h
+#ifndef MERKLE_CAP_H
+#define MERKLE_CAP_H
+
+#include "hash.h"
+#include "hash_policy.h"
+#include "merkle_tree.h"
+#include <span>
+#include <vector>
+
+class ThreadPool;
+
+// A verifier's trusted copy of one level of a remote tree (the cap), for
+// checking many proofs against the same root.
+//
+// The cap is every node digest on level capLevel, from MerkleTree::getCap().
+// It is authenticated once by hashing it up to the root, and the nodes above
+// it are kept. Proofs from MerkleTree::generateTruncatedProof() stop at the
+// cap, so a proof is getLevelCount() - 1 - capLevel digests shorter, and as
+// many hashes cheaper to check, than a full one. With the nodes above it, a
+// cap takes about 64 bytes per entry.
+//
+// When the tree changes, refresh() takes the changed cap entries from
+// MerkleTree::getCapEntries() and rehashes only their paths to the new root.
+template <typename HashPolicy = Sha256Policy>
+class BasicMerkleCap {
+public:
+    // Authenticates cap, the node digests on capLevel of a tree over
+    // totalLeaves leaves, against rootHash. Throws std::invalid_argument if
+    // the cap has the wrong size for that level or does not hash to rootHash.
+    BasicMerkleCap(const Digest& rootHash, size_t totalLeaves, size_t capLevel, std::vector<Digest> cap);
+
+    const Digest& getRootHash() const { return levels.back()[0]; }
+
+    size_t getLeafCount() const { return numLeaves; }
+
+    size_t getCapLevel() const { return capLevel; }
+
+    const std::vector<Digest>& getCap() const { return levels[0]; }
+
+    // Checks a truncated proof for the leaf at index against the cap entry
+    // above it.
+    bool verifyProof(std::span<const byte> data, std::span<const Digest> proof, size_t index) const;
+
+    // Verifies truncated proofs in lockstep groups of 16, so every level of a
+    // group is one multi-lane hash call; groups are spread over pool when one
+    // is given.
+    ProofBitmap verifyBatch(std::span<const ProofCheck> checks, ThreadPool* pool = nullptr) const;
+
+    // Moves to the tree with newRoot over newLeafCount leaves, at least as
+    // many as now. changes must hold every cap entry that differs, including
+    // each one the larger tree adds. Returns false and keeps the current cap
+    // if newLeafCount shrinks, an added entry is missing or the result does
+    // not hash to newRoot.
+    bool refresh(const Digest& newRoot, size_t newLeafCount, std::span<const CapEntry> changes);
+
+private:
+    // levels[0] is the cap and each next level is built from the one below
+    // as in MerkleTree, up to the root.
+    std::vector<std::vector<Digest>> levels;
+
+    size_t numLeaves;
+    size_t capLevel;
+
+    // Rebuilds the parents of the given sorted, distinct cap entries,
+    // recording in undo every node it overwrites.
+    struct Overwrite {
+        size_t level;
+        size_t index;
+        Digest digest;
+    };
+    void rehashPaths(std::vector<size_t> dirty, std::vector<Overwrite>& undo);
+};
+
+typedef BasicMerkleCap<Sha256Policy> MerkleCap;
+
+extern template class BasicMerkleCap<Sha256Policy>;
+extern template class BasicMerkleCap<Blake3Policy>;
+
+#endif // MERKLE_CAP_H
@@ -0,0 +1,221 @@
+// merkle_mountain_range.cpp
+#include "merkle_mountain_range.h"
+#include "merkle_tree.h"
+#include "stats.h"
+#include <bit>
+#include <stdexcept>
+
+namespace {
+
+// Largest power of two strictly below n, for n >= 2: the size of the left
+// subtree of a tree over n leaves.
+size_t leftSplit(size_t n) {
+    return std::bit_floor(n - 1);
+}
+
+} // namespace
+
+template <typename HashPolicy>
+size_t BasicMerkleMountainRange<HashPolicy>::append(const LeafInput& leaf) {
+    Digest leafHash;
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        leafHash = hashLeaf<HashPolicy>(leaf);
+    }
+    return appendLeafHash(leafHash);
+}
+
+template <typename HashPolicy>
+size_t BasicMerkleMountainRange<HashPolicy>::appendLeafHash(const Digest& leafHash) {
+    MERKLE_PHASE(Phase::LevelBuilding);
+    nodes.push_back(leafHash);
+
+    // Each trailing one bit of the old count is a peak of the height the new
+    // subtree has reached, so the two merge.
+    Digest current = leafHash;
+    for (size_t count = numLeaves; count & 1; count >>= 1) {
+        current = HashPolicy::combine(peaks.back(), current);
+        peaks.pop_back();
+        nodes.push_back(current);
+    }
+    peaks.push_back(current);
+    return numLeaves++;
+}
+
+template <typename HashPolicy>
+Digest BasicMerkleMountainRange<HashPolicy>::getRootHash() const {
+    if (numLeaves == 0) {
+        throw std::out_of_range("Mountain range is empty");
+    }
+    Digest root = peaks.back();
+    for (size_t i = peaks.size() - 1; i > 0; i--) {
+        root = HashPolicy::combine(peaks[i - 1], root);
+    }
+    return root;
+}
+
+template <typename HashPolicy>
+Digest BasicMerkleMountainRange<HashPolicy>::getRootHash(size_t size) const {
+    if (size == 0 || size > numLeaves) {
+        throw std::out_of_range("Size out of range");
+    }
+    return size == numLeaves ? getRootHash() : rangeRoot(0, size);
+}
+
+template <typename HashPolicy>
+std::vector<Digest> BasicMerkleMountainRange<HashPolicy>::generateProof(size_t index) const {
+    return generateProof(index, numLeaves);
+}
+
+template <typename HashPolicy>
+std::vector<Digest> BasicMerkleMountainRange<HashPolicy>::generateProof(size_t index, size_t size) const {
+    if (size > numLeaves || index >= size) {
+        throw std::out_of_range("Index out of range");
+    }
+    MERKLE_PHASE(Phase::ProofGeneration);
+    std::vector<Digest> proof;
+    appendPath(index, 0, size, proof);
+    return proof;
+}
+
+template <typename HashPolicy>
+std::vector<Digest> BasicMerkleMountainRange<HashPolicy>::generateConsistencyProof(size_t oldSize,
+                                                                                   size_t newSize) const {
+    if (oldSize == 0 || oldSize > newSize || newSize > numLeaves) {
+        throw std::out_of_range("Size out of range");
+    }
+    MERKLE_PHASE(Phase::ProofGeneration);
+    std::vector<Digest> proof;
+    if (oldSize < newSize) {
+        appendSubproof(oldSize, 0, newSize, true, proof);
+    }
+    return proof;
+}
+
+template <typename HashPolicy>
+bool BasicMerkleMountainRange<HashPolicy>::verifyInclusion(const Digest& rootHash, std::span<const byte> data,
+                                                          std::span<const Digest> proof, size_t index,
+                                                          size_t size) {
+    return BasicMerkleTree<HashPolicy>::verifyProof(rootHash, data, proof, index, size);
+}
+
+template <typename HashPolicy>
+bool BasicMerkleMountainRange<HashPolicy>::verifyConsistency(const Digest& oldRoot, const Digest& newRoot,
+                                                            std::span<const Digest> proof, size_t oldSize,
+                                                            size_t newSize) {
+    MERKLE_PHASE(Phase::Verification);
+    if (oldSize == 0 || oldSize > newSize) {
+        return false;
+    }
+    if (oldSize == newSize) {
+        return proof.empty() && oldRoot == newRoot;
+    }
+
+    // RFC 9162 section 2.1.4.2. When the old tree is a perfect subtree of
+    // the new one its root is the first node of the path and is not sent.
+    bool oldIsPerfect = std::has_single_bit(oldSize);
+    if (proof.empty() && !oldIsPerfect) {
+        return false;
+    }
+    size_t next = oldIsPerfect ? 0 : 1;
+    const Digest& start = oldIsPerfect ? oldRoot : proof[0];
+
+    size_t fn = oldSize - 1;
+    size_t sn = newSize - 1;
+    while (fn & 1) {
+        fn >>= 1;
+        sn >>= 1;
+    }
+
+    Digest fr = start;
+    Digest sr = start;
+    for (; next < proof.size(); next++) {
+        const Digest& c = proof[next];
+        if (sn == 0) {
+            return false;
+        }
+        if ((fn & 1) || fn == sn) {
+            fr = HashPolicy::combine(c, fr);
+            sr = HashPolicy::combine(c, sr);
+            while (!(fn & 1) && fn != 0) {
+                fn >>= 1;
+                sn >>= 1;
+            }
+        } else {
+            sr = HashPolicy::combine(sr, c);
+        }
+        fn >>= 1;
+        sn >>= 1;
+    }
+    return sn == 0 && fr == oldRoot && sr == newRoot;
+}
+
+template <typename HashPolicy>
+const Digest& BasicMerkleMountainRange<HashPolicy>::subtreeHash(size_t first, size_t height) const {
+    // 2a - popcount(a) nodes precede leaf a in post-order, and the subtree
+    // root comes after the 2^(height+1) - 2 other nodes of its subtree.
+    size_t position = 2 * first - std::popcount(first) + (size_t(2) << height) - 2;
+    return nodes[position];
+}
+
+template <typename HashPolicy>
+Digest BasicMerkleMountainRange<HashPolicy>::rangeRoot(size_t first, size_t last) const {
+    // The tiles are the peaks of a log of last - first leaves, shifted to
+    // first. Callers only ask for ranges whose tiles are aligned subtrees.
+    Digest tiles[64];
+    size_t count = 0;
+    while (first < last) {
+        size_t height = std::bit_width(last - first) - 1;
+        if (first != 0) {
+            height = std::min<size_t>(height, std::countr_zero(first));
+        }
+        tiles[count++] = subtreeHash(first, height);
+        first += size_t(1) << height;
+    }
+
+    Digest root = tiles[count - 1];
+    for (size_t i = count - 1; i > 0; i--) {
+        root = HashPolicy::combine(tiles[i - 1], root);
+    }
+    return root;
+}
+
+template <typename HashPolicy>
+void BasicMerkleMountainRange<HashPolicy>::appendPath(size_t index, size_t first, size_t last,
+                                                     std::vector<Digest>& proof) const {
+    // RFC 9162 PATH(m, D[first:last]).
+    if (last - first == 1) {
+        return;
+    }
+    size_t middle = first + leftSplit(last - first);
+    if (index < middle) {
+        appendPath(index, first, middle, proof);
+        proof.push_back(rangeRoot(middle, last));
+    } else {
+        appendPath(index, middle, last, proof);
+        proof.push_back(subtreeHash(first, std::countr_zero(middle - first)));
+    }
+}
+
+template <typename HashPolicy>
+void BasicMerkleMountainRange<HashPolicy>::appendSubproof(size_t oldSize, size_t first, size_t last,
+                                                         bool complete, std::vector<Digest>& proof) const {
+    // RFC 9162 SUBPROOF(m, D[first:last], b).
+    if (oldSize == last - first) {
+        if (!complete) {
+            proof.push_back(rangeRoot(first, last));
+        }
+        return;
+    }
+    size_t split = leftSplit(last - first);
+    if (oldSize <= split) {
+        appendSubproof(oldSize, first, first + split, complete, proof);
+        proof.push_back(rangeRoot(first + split, last));
+    } else {
+        appendSubproof(oldSize - split, first + split, last, false, proof);
+        proof.push_back(subtreeHash(first, std::countr_zero(split)));
+    }
+}
+
+template class BasicMerkleMountainRange<Sha256Policy>;
+template class BasicMerkleMountainRange<Blake3Policy>;
@@ -0,0 +1,93 @@
+// merkle_mountain_range.h
+#ifndef MERKLE_MOUNTAIN_RANGE_H
+#define MERKLE_MOUNTAIN_RANGE_H
+
+#include "hash.h"
+#include "hash_policy.h"
+#include "leaf_input.h"
+#include <span>
+#include <vector>
+
+// An append-only log of leaves, e.g. a tamper-evident audit log.
+//
+// Every node is written once, when its subtree completes, into a flat store in
+// post-order, so an append costs one leaf hash plus on average one pair hash
+// and never moves anything. The peaks (roots of the perfect subtrees that
+// make up the log, one per set bit of the leaf count) are also kept on their
+// own, so the current root never touches the store.
+//
+// The root over the first m leaves folds the peaks of m from right to left.
+// That is exactly the shape MerkleTree builds by carrying up odd nodes, so
+// roots, inclusion proofs and the proof verifier are shared with a
+// BasicMerkleTree<HashPolicy> over the same leaves. Consistency proofs follow
+// RFC 9162 section 2.1.4 over the same hashes.
+template <typename HashPolicy = Sha256Policy>
+class BasicMerkleMountainRange {
+    static_assert(HashPolicy::digestSize == sizeof(Digest), "node storage holds fixed 32-byte digests");
+
+public:
+    BasicMerkleMountainRange() = default;
+
+    // Appends a leaf and returns its index.
+    size_t append(const LeafInput& leaf);
+
+    // Appends a leaf whose HashPolicy::leaf() digest was computed elsewhere.
+    size_t appendLeafHash(const Digest& leafHash);
+
+    size_t getLeafCount() const { return numLeaves; }
+
+    size_t getNodeCount() const { return nodes.size(); }
+
+    // Root over all leaves, or over the first size leaves for any earlier
+    // size. Throws std::out_of_range unless 1 <= size <= getLeafCount().
+    Digest getRootHash() const;
+    Digest getRootHash(size_t size) const;
+
+    // Inclusion proof for leaf index in the log as it was at size leaves,
+    // siblings bottom-up. Throws std::out_of_range unless index < size and
+    // size <= getLeafCount().
+    std::vector<Digest> generateProof(size_t index) const;
+    std::vector<Digest> generateProof(size_t index, size_t size) const;
+
+    // Proof that the log at oldSize leaves is a prefix of the log at newSize.
+    // Throws std::out_of_range unless 1 <= oldSize <= newSize <= getLeafCount().
+    std::vector<Digest> generateConsistencyProof(size_t oldSize, size_t newSize) const;
+
+    // Same check as BasicMerkleTree<HashPolicy>::verifyProof().
+    static bool verifyInclusion(const Digest& rootHash, std::span<const byte> data,
+                                std::span<const Digest> proof, size_t index, size_t size);
+
+    // Checks that oldRoot over oldSize leaves and newRoot over newSize leaves
+    // belong to one log, newSize extending oldSize.
+    static bool verifyConsistency(const Digest& oldRoot, const Digest& newRoot,
+                                  std::span<const Digest> proof, size_t oldSize, size_t newSize);
+
+private:
+    // Every node in post-order: the leaves of a perfect subtree, then its
+    // internal nodes bottom-up, the subtree root last.
+    std::vector<Digest> nodes;
+
+    std::vector<Digest> peaks;
+
+    size_t numLeaves = 0;
+
+    // Root of the perfect subtree of 2^height leaves starting at leaf first,
+    // which must be a multiple of 2^height.
+    const Digest& subtreeHash(size_t first, size_t height) const;
+
+    // Root of the tree over leaves [first, last), from the stored perfect
+    // subtrees that tile it.
+    Digest rangeRoot(size_t first, size_t last) const;
+
+    void appendPath(size_t index, size_t first, size_t last, std::vector<Digest>& proof) const;
+
+    void appendSubproof(size_t oldSize, size_t first, size_t last, bool complete,
+                        std::vector<Digest>& proof) const;
+};
+
+typedef BasicMerkleMountainRange<Sha256Policy> MerkleMountainRange;
+
+extern template class BasicMerkleMountainRange<Sha256Policy>;
+extern template class BasicMerkleMountainRange<Blake3Policy>;
+
+#endif // MERKLE_MOUNTAIN_RANGE_H
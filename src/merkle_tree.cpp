@@ -1,132 +1,697 @@
 // merkle_tree.cpp
 #include "merkle_tree.h"
-#include <cmath>
-#include <functional> 
+#include "stats.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <bit>
+#include <numeric>
 #include <stdexcept>
 
-MerkleTree::MerkleTree(const std::vector<ByteArray>& data) {
+namespace {
+
+// Verifies up to VERIFY_GROUP proofs in lockstep from the leaves up to
+// stopLevel, where proof i must reach targets[index >> stopLevel]. Proofs
+// against the same tree have nearly the same length, so each level is one
+// batch of pair hashes.
+template <typename HashPolicy>
+void verifyGroup(std::span<const Digest> targets, size_t stopLevel, const ProofCheck* checks, size_t count,
+                 size_t totalLeaves, bool* results) {
+    const byte* messages[VERIFY_GROUP];
+    size_t sizes[VERIFY_GROUP];
+    Digest current[VERIFY_GROUP];
+    size_t index[VERIFY_GROUP];
+    size_t proofPos[VERIFY_GROUP];
+
+    for (size_t i = 0; i < count; i++) {
+        messages[i] = checks[i].data.data();
+        sizes[i] = checks[i].data.size();
+        index[i] = checks[i].index;
+        proofPos[i] = 0;
+        results[i] = checks[i].index < totalLeaves;
+    }
+    HashPolicy::leafBatch(messages, sizes, current, count);
+
+    Digest pairs[2 * VERIFY_GROUP];
+    Digest hashed[VERIFY_GROUP];
+    size_t lanes[VERIFY_GROUP];
+
+    size_t nodesInLevel = totalLeaves;
+    for (size_t level = 0; level < stopLevel; level++, nodesInLevel = (nodesInLevel + 1) / 2) {
+        size_t pairCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!results[i] || (index[i] ^ 1) >= nodesInLevel) {
+                continue;
+            }
+            if (proofPos[i] == checks[i].proof.size()) {
+                results[i] = false;
+                continue;
+            }
+            const Digest& sibling = checks[i].proof[proofPos[i]++];
+            bool isLeft = index[i] % 2 == 0;
+            pairs[2 * pairCount] = isLeft ? current[i] : sibling;
+            pairs[2 * pairCount + 1] = isLeft ? sibling : current[i];
+            lanes[pairCount++] = i;
+        }
+
+        HashPolicy::combineBatch(pairs, hashed, pairCount);
+        for (size_t j = 0; j < pairCount; j++) {
+            current[lanes[j]] = hashed[j];
+        }
+        for (size_t i = 0; i < count; i++) {
+            index[i] /= 2;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        results[i] = results[i] && proofPos[i] == checks[i].proof.size() &&
+                     current[i] == targets[checks[i].index >> stopLevel];
+    }
+}
+
+} // namespace
+
+size_t ProofBitmap::countValid() const {
+    size_t valid = 0;
+    for (uint64_t word : words) {
+        valid += std::popcount(word);
+    }
+    return valid;
+}
+
+ProofBitmap verifyInGroups(size_t checkCount, ThreadPool* pool,
+                           const std::function<void(size_t start, size_t count, bool* results)>& verifyGroup) {
+    ProofBitmap bitmap;
+    bitmap.count = checkCount;
+    bitmap.words.assign((checkCount + 63) / 64, 0);
+
+    // Chunks are whole multiples of 64 proofs, so no two tasks share a word.
+    auto verifyRange = [&](size_t begin, size_t end) {
+        bool results[VERIFY_GROUP];
+        for (size_t start = begin; start < end; start += VERIFY_GROUP) {
+            size_t count = std::min(VERIFY_GROUP, end - start);
+            verifyGroup(start, count, results);
+            for (size_t i = 0; i < count; i++) {
+                if (results[i]) {
+                    bitmap.words[(start + i) / 64] |= uint64_t(1) << ((start + i) % 64);
+                }
+            }
+        }
+    };
+
+    const size_t chunk = 1024;
+    if (pool != nullptr && checkCount > chunk) {
+        pool->parallelFor(0, checkCount, chunk, verifyRange);
+    } else {
+        verifyRange(0, checkCount);
+    }
+
+    return bitmap;
+}
+
+template <typename HashPolicy>
+BasicMerkleTree<HashPolicy>::BasicMerkleTree(const std::vector<ByteArray>& data) {
     if (data.empty()) {
         throw std::invalid_argument("Cannot create Merkle tree with empty data.");
     }
     
-    std::vector<std::shared_ptr<Node>> leaves;
-    for (const auto& item : data) {
-        leaves.push_back(std::make_shared<Node>(item));
+    allocateLevels(data.size(), data.size());
+
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        HashPolicy::leafBatch(data.data(), numLeaves, mutableLevelData(0));
     }
     
-    numLeaves = leaves.size();
-    
-    root = buildTree(leaves, 0, leaves.size() - 1);
+    buildTree();
 }
 
-std::shared_ptr<MerkleTree::Node> MerkleTree::buildTree(
-    const std::vector<std::shared_ptr<Node>>& leaves, size_t start, size_t end) {
-    
-    if (start == end) {
-        return leaves[start];
+template <typename HashPolicy>
+BasicMerkleTree<HashPolicy>::BasicMerkleTree(const std::vector<ByteArray>& data, size_t threadCount) {
+    if (data.empty()) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+
+    allocateLevels(data.size(), data.size());
+
+    ThreadPool pool(threadCount);
+    buildSubtree([&](size_t first, size_t count, Digest* output) {
+        HashPolicy::leafBatch(&data[first], count, output);
+    }, pool, getLevelCount() - 1, 0);
+}
+
+template <typename HashPolicy>
+BasicMerkleTree<HashPolicy>::BasicMerkleTree(const std::vector<ByteArray>& data, ThreadPool& pool) {
+    if (data.empty()) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+
+    allocateLevels(data.size(), data.size());
+
+    buildSubtree([&](size_t first, size_t count, Digest* output) {
+        HashPolicy::leafBatch(&data[first], count, output);
+    }, pool, getLevelCount() - 1, 0);
+}
+
+template <typename HashPolicy>
+BasicMerkleTree<HashPolicy>::BasicMerkleTree(std::span<const LeafInput> leaves) {
+    if (leaves.empty()) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+
+    allocateLevels(leaves.size(), leaves.size());
+
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        hashLeaves<HashPolicy>(leaves.data(), numLeaves, mutableLevelData(0));
+    }
+
+    buildTree();
+}
+
+template <typename HashPolicy>
+BasicMerkleTree<HashPolicy>::BasicMerkleTree(std::span<const LeafInput> leaves, size_t threadCount) {
+    ThreadPool pool(threadCount);
+    buildFromInputs(leaves, pool);
+}
+
+template <typename HashPolicy>
+BasicMerkleTree<HashPolicy>::BasicMerkleTree(std::span<const LeafInput> leaves, ThreadPool& pool) {
+    buildFromInputs(leaves, pool);
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::buildFromInputs(std::span<const LeafInput> leaves, ThreadPool& pool) {
+    if (leaves.empty()) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+
+    allocateLevels(leaves.size(), leaves.size());
+
+    bool allInMemory = std::all_of(leaves.begin(), leaves.end(), [](const LeafInput& leaf) { return leaf.inMemory(); });
+    if (allInMemory) {
+        buildSubtree([&](size_t first, size_t count, Digest* output) {
+            hashLeaves<HashPolicy>(&leaves[first], count, output);
+        }, pool, getLevelCount() - 1, 0);
+        return;
+    }
+
+    // Streamed leaves can be large enough that a subtree task would hash
+    // them serially, so level 0 is hashed first in small groups of leaves.
+    size_t grain = std::clamp<size_t>(numLeaves / (8 * pool.getThreadCount()), 1, 256);
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        pool.parallelFor(0, numLeaves, grain, [&](size_t first, size_t last) {
+            hashLeaves<HashPolicy>(&leaves[first], last - first, mutableLevelData(0) + first);
+        });
+    }
+    buildSubtree(LeafHasher(), pool, getLevelCount() - 1, 0);
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::allocateLevels(size_t leafCount, size_t capacity) {
+    numLeaves = leafCount;
+    leafCapacity = capacity;
+
+    levelOffsets.assign(1, 0);
+    for (size_t size = leafCapacity; ; size = (size + 1) / 2) {
+        levelOffsets.push_back(levelOffsets.back() + size);
+        if (size == 1) {
+            break;
+        }
+    }
+    nodes.resize(levelOffsets.back());
+
+    levelCount = 1;
+    while (levelSize(levelCount - 1) > 1) {
+        levelCount++;
+    }
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::ensureWritable() {
+    if (!mapping) {
+        return;
+    }
+
+    std::vector<size_t> mappedOffsets = levelOffsets;
+    const Digest* mapped = mappedNodes;
+    std::shared_ptr<const MappedFile> keepAlive = std::move(mapping);
+    mappedNodes = nullptr;
+
+    allocateLevels(numLeaves, numLeaves);
+    for (size_t level = 0; level < levelCount; level++) {
+        std::copy_n(mapped + mappedOffsets[level], levelSize(level), mutableLevelData(level));
+    }
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::buildTree() {
+    MERKLE_PHASE(Phase::LevelBuilding);
+    for (size_t level = 1; level < getLevelCount(); level++) {
+        buildLevel(level, 0, levelSize(level));
+    }
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::buildLevel(size_t level, size_t begin, size_t end) {
+    const Digest* children = levelData(level - 1);
+    Digest* parents = mutableLevelData(level);
+    size_t childCount = levelSize(level - 1);
+
+    size_t pairedEnd = std::min(end, childCount / 2);
+    if (begin < pairedEnd) {
+        HashPolicy::combineBatch(children + 2 * begin, parents + begin, pairedEnd - begin);
+    }
+    // Only the last node of an odd level lacks a sibling; it is carried up.
+    for (size_t j = std::max(begin, pairedEnd); j < end; j++) {
+        parents[j] = children[2 * j];
+    }
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::buildSubtree(const LeafHasher& hashLeaves, ThreadPool& pool,
+                                               size_t level, size_t index) {
+    if (level <= SERIAL_SUBTREE_LEVEL) {
+        size_t first = index << level;
+        size_t last = std::min(numLeaves, (index + 1) << level);
+        if (hashLeaves) {
+            MERKLE_PHASE(Phase::LeafHashing);
+            hashLeaves(first, last - first, mutableLevelData(0) + first);
+        }
+
+        MERKLE_PHASE(Phase::LevelBuilding);
+        for (size_t h = 1; h <= level; h++) {
+            size_t begin = index << (level - h);
+            size_t end = std::min(levelSize(h), (index + 1) << (level - h));
+            buildLevel(h, begin, end);
+        }
+        return;
+    }
+
+    size_t left = 2 * index;
+    size_t right = left + 1;
+
+    TaskGroup group(pool);
+    if (right < levelSize(level - 1)) {
+        group.spawn([&, right] { buildSubtree(hashLeaves, pool, level - 1, right); });
+    }
+    buildSubtree(hashLeaves, pool, level - 1, left);
+    group.wait();
+
+    buildLevel(level, index, index + 1);
+}
+
+template <typename HashPolicy>
+ByteArray BasicMerkleTree<HashPolicy>::getRootHash() const {
+    return digestToBytes(nodeAt(levelCount - 1, 0));
+}
+
+template <typename HashPolicy>
+const Digest& BasicMerkleTree<HashPolicy>::getNodeHash(size_t level, size_t index) const {
+    if (level >= levelCount || index >= levelSize(level)) {
+        throw std::out_of_range("Node out of range");
+    }
+    return nodeAt(level, index);
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::updateLeaf(size_t index, const ByteArray& data) {
+    if (index >= numLeaves) {
+        throw std::out_of_range("Index out of range");
+    }
+
+    ensureWritable();
+    if (indexed) {
+        leafIndex.erase(levelData(0), index);
+    }
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        mutableLevelData(0)[index] = HashPolicy::leaf(data.data(), data.size());
+    }
+    if (indexed) {
+        leafIndex.insert(levelData(0), index);
+    }
+    MERKLE_PHASE(Phase::LevelBuilding);
+    for (size_t level = 1; level < levelCount; level++) {
+        index /= 2;
+        buildLevel(level, index, index + 1);
     }
-    
-    size_t mid = start + (end - start) / 2;
-    
-    auto left = buildTree(leaves, start, mid);
-    auto right = buildTree(leaves, mid + 1, end);
-    
-    return std::make_shared<Node>(left, right);
 }
 
-ByteArray MerkleTree::getRootHash() const {
-    return root->hash;
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::appendLeaf(const ByteArray& data) {
+    ensureWritable();
+    if (numLeaves == leafCapacity) {
+        std::vector<Digest> oldNodes;
+        oldNodes.swap(nodes);
+        std::vector<size_t> oldOffsets = levelOffsets;
+        size_t oldLevelCount = levelCount;
+
+        allocateLevels(numLeaves, 2 * leafCapacity);
+        for (size_t level = 0; level < oldLevelCount; level++) {
+            std::copy_n(&oldNodes[oldOffsets[level]], levelSize(level), &nodes[levelOffsets[level]]);
+        }
+    }
+
+    size_t index = numLeaves;
+    numLeaves++;
+    if (levelSize(levelCount - 1) > 1) {
+        levelCount++;
+    }
+
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        mutableLevelData(0)[index] = HashPolicy::leaf(data.data(), data.size());
+    }
+    if (indexed) {
+        leafIndex.insert(levelData(0), index);
+    }
+    MERKLE_PHASE(Phase::LevelBuilding);
+    for (size_t level = 1; level < levelCount; level++) {
+        index /= 2;
+        buildLevel(level, index, index + 1);
+    }
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::applyUpdates(std::span<const size_t> indices, std::span<const ByteArray> data) {
+    if (indices.size() != data.size()) {
+        throw std::invalid_argument("Every update needs both an index and data.");
+    }
+    for (size_t index : indices) {
+        if (index >= numLeaves) {
+            throw std::out_of_range("Index out of range");
+        }
+    }
+
+    ensureWritable();
+    std::vector<Digest> leafHashes(data.size());
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        HashPolicy::leafBatch(data.data(), data.size(), leafHashes.data());
+    }
+
+    std::vector<size_t> dirty(indices.begin(), indices.end());
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    if (indexed) {
+        for (size_t index : dirty) {
+            leafIndex.erase(levelData(0), index);
+        }
+    }
+    for (size_t i = 0; i < indices.size(); i++) {
+        mutableLevelData(0)[indices[i]] = leafHashes[i];
+    }
+    if (indexed) {
+        for (size_t index : dirty) {
+            leafIndex.insert(levelData(0), index);
+        }
+    }
+    rehashPaths(std::move(dirty));
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::rehashPaths(std::vector<size_t> dirty) {
+    MERKLE_PHASE(Phase::LevelBuilding);
+    std::vector<Digest> pairs;
+    std::vector<Digest> hashes;
+    std::vector<size_t> paired;
+
+    for (size_t level = 1; level < levelCount && !dirty.empty(); level++) {
+        // Parents of a sorted list stay sorted, so duplicates are adjacent.
+        for (size_t& index : dirty) {
+            index /= 2;
+        }
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+        const Digest* children = levelData(level - 1);
+        Digest* parents = mutableLevelData(level);
+        size_t childCount = levelSize(level - 1);
+
+        pairs.clear();
+        paired.clear();
+        for (size_t parent : dirty) {
+            if (2 * parent + 1 < childCount) {
+                pairs.push_back(children[2 * parent]);
+                pairs.push_back(children[2 * parent + 1]);
+                paired.push_back(parent);
+            } else {
+                parents[parent] = children[2 * parent];
+            }
+        }
+
+        hashes.resize(paired.size());
+        HashPolicy::combineBatch(pairs.data(), hashes.data(), paired.size());
+        for (size_t i = 0; i < paired.size(); i++) {
+            parents[paired[i]] = hashes[i];
+        }
+    }
 }
 
-std::vector<ByteArray> MerkleTree::generateProof(size_t index) const {
+template <typename HashPolicy>
+std::vector<ByteArray> BasicMerkleTree<HashPolicy>::generateProof(size_t index) const {
     if (index >= numLeaves) {
         throw std::out_of_range("Index out of range");
     }
+    MERKLE_PHASE(Phase::ProofGeneration);
     
     std::vector<ByteArray> proof;
+    proof.reserve(getLevelCount());
     size_t currentIndex = index;
-    size_t levelSize = numLeaves;
-    
 
-    size_t height = static_cast<size_t>(std::ceil(std::log2(numLeaves)));
-    size_t nodesInCurrentLevel = numLeaves;
-    
-    std::vector<std::shared_ptr<Node>> currentLevel = std::vector<std::shared_ptr<Node>>(nodesInCurrentLevel);
-    
-    std::function<void(std::shared_ptr<Node>, size_t, size_t, size_t)> fillLevel = 
-        [&](std::shared_ptr<Node> node, size_t nodeIndex, size_t start, size_t end) {
-            if (start == end) {
-                currentLevel[nodeIndex] = node;
-                return;
-            }
-            
-            size_t mid = start + (end - start) / 2;
-            fillLevel(node->left, 2 * nodeIndex, start, mid);
-            fillLevel(node->right, 2 * nodeIndex + 1, mid + 1, end);
-        };
-    
-    fillLevel(root, 0, 0, numLeaves - 1);
-    
-    for (size_t i = 0; i < height; i++) {
-        size_t siblingIndex = (currentIndex % 2 == 0) ? currentIndex + 1 : currentIndex - 1;
+    for (size_t level = 0; level + 1 < getLevelCount(); level++) {
+        size_t siblingIndex = currentIndex ^ 1;
         
-        if (siblingIndex < nodesInCurrentLevel) {
-            proof.push_back(currentLevel[siblingIndex]->hash);
+        if (siblingIndex < levelSize(level)) {
+            proof.push_back(digestToBytes(nodeAt(level, siblingIndex)));
         }
         
         currentIndex /= 2;
-        nodesInCurrentLevel = (nodesInCurrentLevel + 1) / 2;
-        
-        std::vector<std::shared_ptr<Node>> parentLevel(nodesInCurrentLevel);
-        for (size_t j = 0; j < nodesInCurrentLevel; j++) {
-            size_t leftIdx = 2 * j;
-            size_t rightIdx = 2 * j + 1;
-            
-            if (rightIdx < currentLevel.size()) {
-                parentLevel[j] = std::make_shared<Node>(currentLevel[leftIdx], currentLevel[rightIdx]);
-            } else {
-                parentLevel[j] = currentLevel[leftIdx];
-            }
-        }
-        
-        currentLevel = parentLevel;
     }
     
     return proof;
 }
 
-bool MerkleTree::verifyProof(const ByteArray& rootHash, 
-                           const ByteArray& data,
-                           const std::vector<ByteArray>& proof,
-                           size_t index,
-                           size_t totalLeaves) {
+template <typename HashPolicy>
+std::vector<Digest> BasicMerkleTree<HashPolicy>::getCap(size_t level) const {
+    if (level >= levelCount) {
+        throw std::out_of_range("Level out of range");
+    }
+    const Digest* row = levelData(level);
+    return std::vector<Digest>(row, row + levelSize(level));
+}
+
+template <typename HashPolicy>
+std::vector<Digest> BasicMerkleTree<HashPolicy>::generateTruncatedProof(size_t index, size_t capLevel) const {
+    if (index >= numLeaves) {
+        throw std::out_of_range("Index out of range");
+    }
+    if (capLevel >= levelCount) {
+        throw std::out_of_range("Level out of range");
+    }
+    MERKLE_PHASE(Phase::ProofGeneration);
+
+    std::vector<Digest> proof;
+    proof.reserve(capLevel);
+    for (size_t level = 0; level < capLevel; level++) {
+        size_t sibling = (index >> level) ^ 1;
+        if (sibling < levelSize(level)) {
+            proof.push_back(nodeAt(level, sibling));
+        }
+    }
+    return proof;
+}
+
+template <typename HashPolicy>
+std::vector<CapEntry> BasicMerkleTree<HashPolicy>::getCapEntries(size_t level,
+                                                                 std::span<const size_t> leafIndices) const {
+    if (level >= levelCount) {
+        throw std::out_of_range("Level out of range");
+    }
+    std::vector<size_t> entries;
+    entries.reserve(leafIndices.size());
+    for (size_t index : leafIndices) {
+        if (index >= numLeaves) {
+            throw std::out_of_range("Index out of range");
+        }
+        entries.push_back(index >> level);
+    }
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+    std::vector<CapEntry> result;
+    result.reserve(entries.size());
+    for (size_t entry : entries) {
+        result.push_back({entry, nodeAt(level, entry)});
+    }
+    return result;
+}
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::buildLeafIndex() {
+    leafIndex.build(levelData(0), numLeaves);
+    indexed = true;
+}
+
+template <typename HashPolicy>
+std::vector<size_t> BasicMerkleTree<HashPolicy>::findLeaf(const ByteArray& data) const {
+    Digest leafHash = HashPolicy::leaf(data.data(), data.size());
+    if (indexed) {
+        return leafIndex.find(levelData(0), leafHash);
+    }
+
+    std::vector<size_t> positions;
+    const Digest* leaves = levelData(0);
+    for (size_t i = 0; i < numLeaves; i++) {
+        if (leaves[i] == leafHash) {
+            positions.push_back(i);
+        }
+    }
+    return positions;
+}
+
+template <typename HashPolicy>
+LeafProof BasicMerkleTree<HashPolicy>::generateProofFor(const ByteArray& data) const {
+    std::vector<size_t> positions = findLeaf(data);
+    if (positions.empty()) {
+        throw std::out_of_range("Leaf not found");
+    }
+    return LeafProof{positions[0], generateProof(positions[0])};
+}
+
+template <typename HashPolicy>
+std::vector<std::vector<ByteArray>> BasicMerkleTree<HashPolicy>::generateProofs(std::span<const size_t> indices) const {
+    for (size_t index : indices) {
+        if (index >= numLeaves) {
+            throw std::out_of_range("Index out of range");
+        }
+    }
+
+    MERKLE_PHASE(Phase::ProofGeneration);
+    std::vector<size_t> order(indices.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return indices[a] < indices[b]; });
+
+    std::vector<std::vector<ByteArray>> proofs(indices.size());
+    std::vector<size_t> currentIndex(indices.begin(), indices.end());
+    for (auto& proof : proofs) {
+        proof.reserve(getLevelCount());
+    }
+
+    for (size_t level = 0; level + 1 < getLevelCount(); level++) {
+        const Digest* levelNodes = levelData(level);
+        size_t nodesInLevel = levelSize(level);
+
+        for (size_t k : order) {
+            size_t siblingIndex = currentIndex[k] ^ 1;
+            if (siblingIndex < nodesInLevel) {
+                proofs[k].push_back(digestToBytes(levelNodes[siblingIndex]));
+            }
+            currentIndex[k] /= 2;
+        }
+    }
+
+    return proofs;
+}
+
+template <typename HashPolicy>
+bool BasicMerkleTree<HashPolicy>::verifyProof(const ByteArray& rootHash, 
+                                            const ByteArray& data,
+                                            const std::vector<ByteArray>& proof,
+                                            size_t index,
+                                            size_t totalLeaves) {
 
-    ByteArray computedHash = commit(data);
+    if (index >= totalLeaves || rootHash.size() != HashPolicy::digestSize) {
+        return false;
+    }
+    MERKLE_PHASE(Phase::Verification);
+
+    Digest computedHash = HashPolicy::leaf(data.data(), data.size());
     size_t currentIndex = index;
+    size_t nodesInCurrentLevel = totalLeaves;
+    size_t proofPos = 0;
     
-    for (const auto& siblingHash : proof) {
-        ByteArray combined;
+    // Walk the same level shape as the prover: a node without a sibling is
+    // carried up and consumes no proof entry.
+    while (nodesInCurrentLevel > 1) {
+        if ((currentIndex ^ 1) < nodesInCurrentLevel) {
+            if (proofPos == proof.size() || proof[proofPos].size() != HashPolicy::digestSize) {
+                return false;
+            }
+
+            Digest siblingHash;
+            std::copy(proof[proofPos].begin(), proof[proofPos].end(), siblingHash.begin());
+            proofPos++;
 
-        if (currentIndex % 2 == 0) { 
-            combined.insert(combined.end(), computedHash.begin(), computedHash.end());
-            combined.insert(combined.end(), siblingHash.begin(), siblingHash.end());
-        } else {
-            combined.insert(combined.end(), siblingHash.begin(), siblingHash.end());
-            combined.insert(combined.end(), computedHash.begin(), computedHash.end());
+            if (currentIndex % 2 == 0) {
+                computedHash = HashPolicy::combine(computedHash, siblingHash);
+            } else {
+                computedHash = HashPolicy::combine(siblingHash, computedHash);
+            }
         }
         
-        computedHash = sha256(combined);
-        
         currentIndex /= 2;
+        nodesInCurrentLevel = (nodesInCurrentLevel + 1) / 2;
     }
     
-    return computedHash == rootHash;
+    return proofPos == proof.size() &&
+           std::equal(computedHash.begin(), computedHash.end(), rootHash.begin());
+}
+
+template <typename HashPolicy>
+bool BasicMerkleTree<HashPolicy>::verifyProof(const Digest& rootHash,
+                                              std::span<const byte> data,
+                                              std::span<const Digest> proof,
+                                              size_t index,
+                                              size_t totalLeaves) {
+    if (index >= totalLeaves) {
+        return false;
+    }
+    MERKLE_PHASE(Phase::Verification);
+
+    Digest computedHash = HashPolicy::leaf(data.data(), data.size());
+    size_t proofPos = 0;
+
+    for (size_t nodesInLevel = totalLeaves; nodesInLevel > 1; nodesInLevel = (nodesInLevel + 1) / 2) {
+        if ((index ^ 1) < nodesInLevel) {
+            if (proofPos == proof.size()) {
+                return false;
+            }
+            const Digest& sibling = proof[proofPos++];
+            computedHash = index % 2 == 0 ? HashPolicy::combine(computedHash, sibling) : HashPolicy::combine(sibling, computedHash);
+        }
+        index /= 2;
+    }
+
+    return proofPos == proof.size() && computedHash == rootHash;
 }
 
-size_t MerkleTree::nextPowerOfTwo(size_t n) {
-    size_t power = 1;
-    while (power < n) {
-        power *= 2;
+template <typename HashPolicy>
+ProofBitmap BasicMerkleTree<HashPolicy>::verifyBatch(const Digest& rootHash,
+                                                     std::span<const ProofCheck> checks,
+                                                     size_t totalLeaves,
+                                                     ThreadPool* pool) {
+    // Every valid index reaches the root after bit_width(totalLeaves - 1)
+    // levels, and index >> that level is 0.
+    size_t rootLevel = totalLeaves > 1 ? std::bit_width(totalLeaves - 1) : 0;
+    return verifyBatchToLevel(std::span<const Digest>(&rootHash, 1), rootLevel, checks, totalLeaves, pool);
+}
+
+template <typename HashPolicy>
+ProofBitmap BasicMerkleTree<HashPolicy>::verifyBatchToLevel(std::span<const Digest> targets,
+                                                            size_t stopLevel,
+                                                            std::span<const ProofCheck> checks,
+                                                            size_t totalLeaves,
+                                                            ThreadPool* pool) {
+    if (totalLeaves > 0 && targets.size() != (stopLevel < 64 ? ((totalLeaves - 1) >> stopLevel) + 1 : 1)) {
+        throw std::invalid_argument("Targets do not cover the stop level.");
     }
-    return power;
-}
\ No newline at end of file
+    MERKLE_PHASE(Phase::Verification);
+    return verifyInGroups(checks.size(), pool, [&](size_t start, size_t count, bool* results) {
+        verifyGroup<HashPolicy>(targets, stopLevel, &checks[start], count, totalLeaves, results);
+    });
+}
+
+template class BasicMerkleTree<Sha256Policy>;
+template class BasicMerkleTree<Blake3Policy>;
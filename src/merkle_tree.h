@@ -3,16 +3,94 @@
 #define MERKLE_TREE_H
 
 #include "hash.h"
-#include <vector>
+#include "hash_policy.h"
+#include "leaf_index.h"
+#include "leaf_input.h"
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+class MappedFile;
+class ThreadPool;
+struct MultiProof;
+
+// A proof to check with MerkleTree::verifyBatch(). The views point at caller
+// memory and are not copied.
+struct ProofCheck {
+    std::span<const byte> data;
+    std::span<const Digest> proof;
+    size_t index;
+};
+
+// A proof found by leaf content: the leaf's index, which verifyProof() needs,
+// and its siblings bottom-up.
+struct LeafProof {
+    size_t index;
+    std::vector<ByteArray> proof;
+};
+
+// One node digest of a cap (merkle_cap.h): entry index on the cap's level.
+struct CapEntry {
+    size_t index;
+    Digest digest;
+};
+
+// One bit per checked proof, set when that proof is valid.
+struct ProofBitmap {
+    std::vector<uint64_t> words;
+    size_t count = 0;
+
+    bool test(size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+
+    size_t countValid() const;
+};
+
+// Proofs a lockstep batch verifier advances together.
+const size_t VERIFY_GROUP = 16;
+
+// Fills a bitmap over checkCount proofs with verifyGroup(start, count,
+// results), called on consecutive groups of at most VERIFY_GROUP proofs and
+// spread over pool when one is given. The batch verifiers share it.
+ProofBitmap verifyInGroups(size_t checkCount, ThreadPool* pool,
+                           const std::function<void(size_t start, size_t count, bool* results)>& verifyGroup);
+
+// A Merkle tree over HashPolicy (hash_policy.h). MerkleTree is the SHA-256
+// tree; proofs, files and roots of one policy are meaningless to another.
+template <typename HashPolicy = Sha256Policy>
+class BasicMerkleTree {
+    static_assert(HashPolicy::digestSize == sizeof(Digest), "node storage holds fixed 32-byte digests");
 
-class MerkleTree {
 public:
-    MerkleTree(const std::vector<ByteArray>& data);
+    BasicMerkleTree(const std::vector<ByteArray>& data);
+
+    // Parallel build with threadCount threads (0 uses every hardware thread).
+    // Leaves are hashed inside subtree tasks, so the root is identical to the
+    // serial build.
+    BasicMerkleTree(const std::vector<ByteArray>& data, size_t threadCount);
+
+    BasicMerkleTree(const std::vector<ByteArray>& data, ThreadPool& pool);
+
+    // Builds from leaves that are viewed, mapped or streamed in place rather
+    // than copied into ByteArrays (leaf_input.h); the root is the same as for
+    // the equivalent ByteArray leaves. With a pool, file and reader leaves
+    // are hashed in parallel with each other.
+    explicit BasicMerkleTree(std::span<const LeafInput> leaves);
+
+    BasicMerkleTree(std::span<const LeafInput> leaves, size_t threadCount);
+
+    BasicMerkleTree(std::span<const LeafInput> leaves, ThreadPool& pool);
     
     ByteArray getRootHash() const;
     
     std::vector<ByteArray> generateProof(size_t index) const;
+
+    // Proofs for many leaves at once, in the order of indices. The batch walks
+    // the tree level by level so each level's digests are visited in index
+    // order once for all requests.
+    std::vector<std::vector<ByteArray>> generateProofs(std::span<const size_t> indices) const;
     
     static bool verifyProof(const ByteArray& rootHash, 
                            const ByteArray& data,
@@ -20,31 +98,181 @@ public:
                            size_t index,
                            size_t totalLeaves);
 
+    // Allocation-free form of verifyProof(): the path is hashed in stack
+    // digests and the inputs are views, so nothing is copied per proof.
+    static bool verifyProof(const Digest& rootHash,
+                            std::span<const byte> data,
+                            std::span<const Digest> proof,
+                            size_t index,
+                            size_t totalLeaves);
+
+    // Verifies independent proofs against one root. Proofs advance through the
+    // levels in groups of 16 so each step of a group is one multi-lane hash
+    // call, and groups are spread over pool when one is given.
+    static ProofBitmap verifyBatch(const Digest& rootHash,
+                                   std::span<const ProofCheck> checks,
+                                   size_t totalLeaves,
+                                   ThreadPool* pool = nullptr);
+
+    // verifyBatch() for proofs that end below the root, as those from
+    // generateTruncatedProof() do: each proof is hashed up to stopLevel and
+    // must reach targets[index >> stopLevel], the trusted digests of that
+    // level. Throws std::invalid_argument if targets is not that level's size.
+    static ProofBitmap verifyBatchToLevel(std::span<const Digest> targets,
+                                          size_t stopLevel,
+                                          std::span<const ProofCheck> checks,
+                                          size_t totalLeaves,
+                                          ThreadPool* pool = nullptr);
+
+    // Writes the proof for index in the binary proof format (proof_format.h)
+    // without building it first. Returns the bytes written, or 0 if out is too
+    // short; encodedProofSize(getLevelCount() - 1) bytes fit any proof.
+    size_t encodeProof(size_t index, std::span<byte> out) const;
+
+    // One proof covering every leaf in indices (see multiproof.h). Duplicate
+    // indices are proven once.
+    MultiProof generateMultiProof(std::span<const size_t> indices) const;
+
+    // Checks a multiproof in one pass, hashing each ancestor shared by several
+    // proven leaves once. data[i] is the leaf at proof.indices[i].
+    static bool verifyMultiProof(const ByteArray& rootHash,
+                                 std::span<const ByteArray> data,
+                                 const MultiProof& proof);
+
+    // Replaces one leaf and rehashes only its path to the root.
+    void updateLeaf(size_t index, const ByteArray& data);
+
+    // Adds a leaf after the last one. Storage grows geometrically, so an append
+    // costs O(log n) hashes plus amortised O(1) copying.
+    void appendLeaf(const ByteArray& data);
+
+    // Replaces leaves indices[i] with data[i]. Dirty paths are recomputed level
+    // by level, so an ancestor shared by several updated leaves is hashed once.
+    // If an index repeats, the last update wins.
+    void applyUpdates(std::span<const size_t> indices, std::span<const ByteArray> data);
+
+    // Every node digest on level, for a verifier to authenticate once and
+    // check truncated proofs against (merkle_cap.h). Throws std::out_of_range
+    // for a level above the root.
+    std::vector<Digest> getCap(size_t level) const;
+
+    // The siblings of generateProof(index) below capLevel: the proof up to
+    // the cap entry above the leaf. Throws std::out_of_range for a bad index
+    // or level.
+    std::vector<Digest> generateTruncatedProof(size_t index, size_t capLevel) const;
+
+    // The cap entries above the given leaves, ascending and each once: what a
+    // cap on level needs to follow updates to or appends of those leaves.
+    std::vector<CapEntry> getCapEntries(size_t level, std::span<const size_t> leafIndices) const;
+
+    // Indexes the leaf digests (leaf_index.h) so findLeaf() and
+    // generateProofFor() need no scan. Updates and appends keep the index
+    // current. Throws std::invalid_argument for 2^32 - 1 leaves or more.
+    void buildLeafIndex();
+
+    bool hasLeafIndex() const { return indexed; }
+
+    // Every index whose leaf is data, ascending. Without the index this
+    // scans the leaf level.
+    std::vector<size_t> findLeaf(const ByteArray& data) const;
+
+    // Proof for the first leaf equal to data: one digest lookup, then the
+    // usual path walk. Throws std::out_of_range if no leaf is data.
+    LeafProof generateProofFor(const ByteArray& data) const;
+
+    // Writes the level digests in the versioned tree file format (tree_file.h).
+    void save(const std::string& path) const;
+
+    // Opens a saved tree without rebuilding or copying it: proofs and the root
+    // are served straight from a read-only mapping of the file. Only the header
+    // is checked unless verifyBody is set, which rehashes the digest body
+    // against its checksum. The first update copies the tree into memory.
+    static BasicMerkleTree openMapped(const std::string& path, bool verifyBody = false);
+
+    bool isMapped() const { return mapping != nullptr; }
+
+    size_t getLeafCount() const { return numLeaves; }
+
+    size_t getLevelCount() const { return levelCount; }
+
+    size_t getLevelSize(size_t level) const { return levelSize(level); }
+
+    // Stored digest of node index on level (0 = leaves), e.g. for comparing
+    // trees node by node. Throws std::out_of_range outside the tree.
+    const Digest& getNodeHash(size_t level, size_t index) const;
+
 private:
-    struct Node {
-        ByteArray hash;
-        std::shared_ptr<Node> left;
-        std::shared_ptr<Node> right;
-        
-        Node(const ByteArray& data) : hash(commit(data)), left(nullptr), right(nullptr) {}
-        
-        Node(std::shared_ptr<Node> left, std::shared_ptr<Node> right) 
-            : left(left), right(right) {
-
-            ByteArray combined;
-            combined.insert(combined.end(), left->hash.begin(), left->hash.end());
-            combined.insert(combined.end(), right->hash.begin(), right->hash.end());
-            hash = sha256(combined);
-        }
-    };
-    
-    std::shared_ptr<Node> root;
+    // Every node digest of the tree in one contiguous buffer, stored level by
+    // level from the leaves up to the root. Level h holds ceil(n / 2^h) entries
+    // and the parent of node i is node i / 2 on the next level. When a level has
+    // an odd number of nodes, the last one has no sibling and is carried up
+    // unchanged.
+    std::vector<Digest> nodes;
+
+    // levelOffsets[h] is the index in nodes of the first digest on level h.
+    // Levels are laid out for leafCapacity leaves so appends fit in place.
+    std::vector<size_t> levelOffsets;
+
     size_t numLeaves;
+    size_t leafCapacity;
+    size_t levelCount;
+
+    // Set when the digests live in a mapped tree file instead of nodes.
+    std::shared_ptr<const MappedFile> mapping;
+    const Digest* mappedNodes = nullptr;
+
+    // Built on request by buildLeafIndex().
+    LeafIndex leafIndex;
+    bool indexed = false;
+
+    BasicMerkleTree() = default;
+
+    // Subtrees at or below this level (2^13 leaves) are built by a single task.
+    static constexpr size_t SERIAL_SUBTREE_LEVEL = 13;
+
+    void allocateLevels(size_t leafCount, size_t capacity);
+
+    // Copies mapped digests into nodes before the first modification.
+    void ensureWritable();
     
-    std::shared_ptr<Node> buildTree(const std::vector<std::shared_ptr<Node>>& leaves, 
-                                    size_t start, size_t end);
+    void buildTree();
+
+    // Computes nodes [begin, end) of level from the level below it.
+    void buildLevel(size_t level, size_t begin, size_t end);
+
+    // Hashes leaves [first, first + count) into output. Empty when level 0 is
+    // already filled in.
+    typedef std::function<void(size_t first, size_t count, Digest* output)> LeafHasher;
 
-    size_t nextPowerOfTwo(size_t n);
+    void buildSubtree(const LeafHasher& hashLeaves, ThreadPool& pool, size_t level, size_t index);
+
+    void buildFromInputs(std::span<const LeafInput> leaves, ThreadPool& pool);
+
+    // Recomputes the ancestors of the given sorted, distinct leaf indices.
+    void rehashPaths(std::vector<size_t> dirty);
+
+    const Digest* levelData(size_t level) const {
+        return (mapping ? mappedNodes : nodes.data()) + levelOffsets[level];
+    }
+
+    Digest* mutableLevelData(size_t level) {
+        return nodes.data() + levelOffsets[level];
+    }
+
+    const Digest& nodeAt(size_t level, size_t index) const {
+        return levelData(level)[index];
+    }
+
+    size_t levelSize(size_t level) const {
+        return ((numLeaves - 1) >> level) + 1;
+    }
 };
 
-#endif // MERKLE_TREE_H
\ No newline at end of file
+typedef BasicMerkleTree<Sha256Policy> MerkleTree;
+typedef BasicMerkleTree<Blake3Policy> Blake3MerkleTree;
+
+// Members are defined in the .cpp files and instantiated there for both policies.
+extern template class BasicMerkleTree<Sha256Policy>;
+extern template class BasicMerkleTree<Blake3Policy>;
+
+#endif // MERKLE_TREE_H
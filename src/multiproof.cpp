@@ -0,0 +1,125 @@
+// multiproof.cpp
+#include "merkle_tree.h"
+#include "multiproof.h"
+#include "stats.h"
+#include <algorithm>
+#include <stdexcept>
+
+template <typename HashPolicy>
+MultiProof BasicMerkleTree<HashPolicy>::generateMultiProof(std::span<const size_t> indices) const {
+    for (size_t index : indices) {
+        if (index >= numLeaves) {
+            throw std::out_of_range("Index out of range");
+        }
+    }
+
+    MERKLE_PHASE(Phase::ProofGeneration);
+    MultiProof proof;
+    proof.totalLeaves = numLeaves;
+    proof.indices.assign(indices.begin(), indices.end());
+    std::sort(proof.indices.begin(), proof.indices.end());
+    proof.indices.erase(std::unique(proof.indices.begin(), proof.indices.end()), proof.indices.end());
+
+    std::vector<size_t> known = proof.indices;
+    std::vector<size_t> parents;
+
+    for (size_t level = 0; level + 1 < levelCount; level++) {
+        size_t nodesInLevel = levelSize(level);
+        parents.clear();
+
+        for (size_t k = 0; k < known.size(); k++) {
+            size_t index = known[k];
+            size_t sibling = index ^ 1;
+
+            if (index % 2 == 0 && k + 1 < known.size() && known[k + 1] == sibling) {
+                k++;
+            } else if (sibling < nodesInLevel) {
+                proof.siblings.push_back(nodeAt(level, sibling));
+            }
+            parents.push_back(index / 2);
+        }
+
+        known.swap(parents);
+    }
+
+    return proof;
+}
+
+template <typename HashPolicy>
+bool BasicMerkleTree<HashPolicy>::verifyMultiProof(const ByteArray& rootHash,
+                                                   std::span<const ByteArray> data,
+                                                   const MultiProof& proof) {
+    const std::vector<size_t>& indices = proof.indices;
+    if (indices.empty() || data.size() != indices.size() || rootHash.size() != HashPolicy::digestSize) {
+        return false;
+    }
+    for (size_t k = 0; k < indices.size(); k++) {
+        if (indices[k] >= proof.totalLeaves || (k > 0 && indices[k] <= indices[k - 1])) {
+            return false;
+        }
+    }
+
+    MERKLE_PHASE(Phase::Verification);
+    std::vector<size_t> known = indices;
+    std::vector<Digest> hashes(data.size());
+    HashPolicy::leafBatch(data.data(), data.size(), hashes.data());
+
+    std::vector<size_t> parents;
+    std::vector<Digest> parentHashes;
+    std::vector<Digest> pairs;
+    std::vector<size_t> pairedSlots;
+    size_t siblingPos = 0;
+
+    for (size_t nodesInLevel = proof.totalLeaves; nodesInLevel > 1; nodesInLevel = (nodesInLevel + 1) / 2) {
+        parents.clear();
+        parentHashes.clear();
+        pairs.clear();
+        pairedSlots.clear();
+
+        for (size_t k = 0; k < known.size(); k++) {
+            size_t index = known[k];
+            size_t sibling = index ^ 1;
+            bool paired = true;
+
+            if (index % 2 == 0 && k + 1 < known.size() && known[k + 1] == sibling) {
+                pairs.push_back(hashes[k]);
+                pairs.push_back(hashes[k + 1]);
+                k++;
+            } else if (sibling < nodesInLevel) {
+                if (siblingPos == proof.siblings.size()) {
+                    return false;
+                }
+                const Digest& siblingHash = proof.siblings[siblingPos++];
+                pairs.push_back(index % 2 == 0 ? hashes[k] : siblingHash);
+                pairs.push_back(index % 2 == 0 ? siblingHash : hashes[k]);
+            } else {
+                paired = false;
+            }
+
+            if (paired) {
+                pairedSlots.push_back(parents.size());
+            }
+            parents.push_back(index / 2);
+            parentHashes.push_back(hashes[k]);
+        }
+
+        // Hash every pair of this level in one batch, then drop the results
+        // into their parent slots; carried-up nodes already hold their digest.
+        std::vector<Digest> combined(pairedSlots.size());
+        HashPolicy::combineBatch(pairs.data(), combined.data(), pairedSlots.size());
+        for (size_t i = 0; i < pairedSlots.size(); i++) {
+            parentHashes[pairedSlots[i]] = combined[i];
+        }
+
+        known.swap(parents);
+        hashes.swap(parentHashes);
+    }
+
+    return siblingPos == proof.siblings.size() &&
+           std::equal(hashes[0].begin(), hashes[0].end(), rootHash.begin());
+}
+
+template MultiProof MerkleTree::generateMultiProof(std::span<const size_t>) const;
+template MultiProof Blake3MerkleTree::generateMultiProof(std::span<const size_t>) const;
+template bool MerkleTree::verifyMultiProof(const ByteArray&, std::span<const ByteArray>, const MultiProof&);
+template bool Blake3MerkleTree::verifyMultiProof(const ByteArray&, std::span<const ByteArray>, const MultiProof&);
@@ -0,0 +1,22 @@
+// multiproof.h
+#ifndef MULTIPROOF_H
+#define MULTIPROOF_H
+
+#include "hash.h"
+#include <vector>
+
+// Inclusion proof for several leaves of one tree. It carries only the digests
+// that cannot be computed from the proven leaves themselves, so siblings shared
+// between paths near the root appear once.
+struct MultiProof {
+    // Proven leaf indices, sorted and without duplicates.
+    std::vector<size_t> indices;
+
+    // Missing sibling digests, level by level from the leaves up and in index
+    // order within a level; the order in which verification consumes them.
+    std::vector<Digest> siblings;
+
+    size_t totalLeaves = 0;
+};
+
+#endif // MULTIPROOF_H
@@ -0,0 +1,561 @@
+// paged_merkle_tree.cpp
+#include "paged_merkle_tree.h"
+#include "hash_policy.h"
+#include "stats.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+static_assert(std::endian::native == std::endian::little, "page files are stored little-endian");
+
+namespace {
+
+const size_t MIN_PAGE_SIZE = 512;
+const size_t MAX_PAGE_SIZE = size_t(1) << 20;
+
+// Completed pages gathered per band before one write.
+const size_t WRITE_RUN_BYTES = size_t(1) << 20;
+
+Digest headerChecksum(const PagedFileHeader& header) {
+    return sha256Digest(reinterpret_cast<const byte*>(&header), offsetof(PagedFileHeader, headerChecksum));
+}
+
+void checkPageSize(size_t pageSize) {
+    if (pageSize < MIN_PAGE_SIZE || pageSize > MAX_PAGE_SIZE || !std::has_single_bit(pageSize)) {
+        throw std::invalid_argument("Page size must be a power of two from 512 bytes to 1 MiB.");
+    }
+}
+
+std::vector<size_t> levelSizesFor(size_t leafCount) {
+    std::vector<size_t> sizes;
+    for (size_t size = leafCount; ; size = (size + 1) / 2) {
+        sizes.push_back(size);
+        if (size == 1) {
+            return sizes;
+        }
+    }
+}
+
+// Levels of a band: the largest h whose 2^(h+1) - 2 nodes fit in a page.
+size_t bandHeightFor(size_t pageSize) {
+    size_t slots = pageSize / sizeof(Digest);
+    return std::bit_width(slots + 2) - 2;
+}
+
+// Reads exactly size bytes at offset.
+void readAt(int fd, byte* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = ::pread(fd, data, size, off_t(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(n < 0 ? std::string("Cannot read page file: ") + std::strerror(errno)
+                                           : std::string("Page file is truncated."));
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+} // namespace
+
+PagedLayout::PagedLayout(size_t leafCount, size_t pageSize, size_t pagedLevels)
+    : levelSizes(levelSizesFor(leafCount)),
+      pageSize(pageSize),
+      bandHeight(0),
+      pagedLevels(pagedLevels) {
+    checkPageSize(pageSize);
+    if (pagedLevels >= levelSizes.size()) {
+        throw std::invalid_argument("The root level cannot be paged.");
+    }
+    bandHeight = bandHeightFor(pageSize);
+
+    bandFirstPages.assign(1, 0);
+    for (size_t base = 0; base < pagedLevels; base += bandHeight) {
+        size_t height = std::min(bandHeight, pagedLevels - base);
+        size_t pages = ((levelSizes[base] - 1) >> height) + 1;
+        bandFirstPages.push_back(bandFirstPages.back() + pages);
+    }
+}
+
+size_t PagedLayout::choosePagedLevels(size_t leafCount, size_t pageSize, size_t pinnedBudget) {
+    checkPageSize(pageSize);
+    std::vector<size_t> sizes = levelSizesFor(leafCount);
+    size_t height = bandHeightFor(pageSize);
+
+    // Walk down from the root while the levels still fit, then round the
+    // boundary up to a whole band: a short band would spend a page on a few
+    // nodes.
+    size_t pinned = 0;
+    size_t level = sizes.size();
+    while (level > 0 && (pinned + sizes[level - 1]) * sizeof(Digest) <= pinnedBudget) {
+        pinned += sizes[--level];
+    }
+    if (level == 0) {
+        return 0;
+    }
+    size_t rounded = (level + height - 1) / height * height;
+    return std::min(rounded, sizes.size() - 1);
+}
+
+size_t PagedLayout::getTopSize() const {
+    size_t nodes = 0;
+    for (size_t level = pagedLevels; level < levelSizes.size(); level++) {
+        nodes += levelSizes[level];
+    }
+    return nodes * sizeof(Digest);
+}
+
+size_t PagedLayout::heightOf(size_t band) const {
+    return std::min(bandHeight, pagedLevels - band * bandHeight);
+}
+
+size_t PagedLayout::pageOf(size_t level, size_t index) const {
+    size_t band = bandOf(level);
+    size_t shift = heightOf(band) - (level - band * bandHeight);
+    return bandFirstPages[band] + (index >> shift);
+}
+
+size_t PagedLayout::slotOf(size_t level, size_t index) const {
+    size_t band = bandOf(level);
+    size_t height = heightOf(band);
+    size_t shift = height - (level - band * bandHeight);
+    // Levels below this one in the page take 2^height + ... + 2^(shift+1) slots.
+    size_t below = (size_t(2) << height) - (size_t(2) << shift);
+    return below + (index & ((size_t(1) << shift) - 1));
+}
+
+size_t PagedLayout::nodesInPage(size_t page) const {
+    size_t band = std::upper_bound(bandFirstPages.begin(), bandFirstPages.end(), page) - bandFirstPages.begin() - 1;
+    size_t base = band * bandHeight;
+    size_t height = heightOf(band);
+    size_t subtree = page - bandFirstPages[band];
+
+    size_t nodes = 0;
+    for (size_t k = 0; k < height; k++) {
+        size_t shift = height - k;
+        size_t first = subtree << shift;
+        size_t last = std::min((subtree + 1) << shift, levelSizes[base + k]);
+        nodes += last - first;
+    }
+    return nodes;
+}
+
+PagedTreeWriter::PagedTreeWriter(const std::string& path, size_t leafCount, const PagedTreeOptions& options)
+    : path(path),
+      temporaryPath(path + ".tmp"),
+      fd(-1),
+      leafCount(leafCount),
+      builder([this](size_t level, size_t index, const Digest& digest) { place(level, index, digest); }) {
+    if (leafCount == 0) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+    size_t pagedLevels = PagedLayout::choosePagedLevels(leafCount, options.pageSize, options.memoryBudget / 2);
+    layout = PagedLayout(leafCount, options.pageSize, pagedLevels);
+
+    for (size_t level = pagedLevels; level < layout.getLevelCount(); level++) {
+        top.emplace_back(layout.getLevelSize(level));
+    }
+    openPages.resize(layout.getBandCount());
+    pending.resize(layout.getBandCount());
+
+    fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot create " + temporaryPath + ": " + std::strerror(errno));
+    }
+}
+
+PagedTreeWriter::~PagedTreeWriter() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (!finished) {
+        std::remove(temporaryPath.c_str());
+    }
+}
+
+void PagedTreeWriter::addLeaf(const LeafInput& leaf) {
+    if (builder.getLeafCount() == leafCount) {
+        throw std::logic_error("More leaves than the page file was sized for.");
+    }
+    builder.addLeaf(leaf);
+}
+
+void PagedTreeWriter::addLeafHash(const Digest& leafHash) {
+    if (builder.getLeafCount() == leafCount) {
+        throw std::logic_error("More leaves than the page file was sized for.");
+    }
+    builder.addLeafHash(leafHash);
+}
+
+void PagedTreeWriter::place(size_t level, size_t index, const Digest& digest) {
+    if (level >= layout.getPagedLevels()) {
+        top[level - layout.getPagedLevels()][index] = digest;
+        return;
+    }
+
+    size_t band = layout.bandOf(level);
+    size_t page = layout.pageOf(level, index);
+    std::vector<std::pair<size_t, OpenPage>>& open = openPages[band];
+    auto it = std::find_if(open.begin(), open.end(), [page](const auto& entry) { return entry.first == page; });
+    if (it == open.end()) {
+        open.emplace_back(page, OpenPage{std::vector<byte>(layout.getPageSize(), 0), 0});
+        it = open.end() - 1;
+    }
+
+    OpenPage& target = it->second;
+    std::memcpy(target.data.data() + layout.slotOf(level, index) * sizeof(Digest), digest.data(), sizeof(Digest));
+    if (++target.filled == layout.nodesInPage(page)) {
+        completePage(band, page, target.data);
+        open.erase(it);
+    }
+}
+
+void PagedTreeWriter::completePage(size_t band, size_t page, std::vector<byte>& data) {
+    PendingPages& run = pending[band];
+    if (run.count > 0 && (run.firstPage + run.count != page || (run.count + 1) * data.size() > WRITE_RUN_BYTES)) {
+        flush(run);
+    }
+    if (run.count == 0) {
+        run.firstPage = page;
+    }
+    run.data.insert(run.data.end(), data.begin(), data.end());
+    run.count++;
+}
+
+void PagedTreeWriter::flush(PendingPages& run) {
+    if (run.count > 0) {
+        writeAt(run.data.data(), run.data.size(), PAGED_FILE_BODY_OFFSET + uint64_t(run.firstPage) * layout.getPageSize());
+    }
+    run.data.clear();
+    run.count = 0;
+}
+
+void PagedTreeWriter::writeAt(const byte* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = ::pwrite(fd, data, size, off_t(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error("Cannot write " + temporaryPath + ": " + std::strerror(errno));
+        }
+        data += n;
+        size -= n;
+        offset += n;
+    }
+}
+
+ByteArray PagedTreeWriter::finish() {
+    if (finished) {
+        throw std::logic_error("finish() was already called.");
+    }
+    if (builder.getLeafCount() != leafCount) {
+        throw std::logic_error("Page file expects " + std::to_string(leafCount) + " leaves, got " +
+                               std::to_string(builder.getLeafCount()));
+    }
+    ByteArray root = builder.finish();
+
+    for (PendingPages& run : pending) {
+        flush(run);
+    }
+
+    uint64_t offset = layout.getTopOffset();
+    for (const std::vector<Digest>& level : top) {
+        writeAt(level[0].data(), level.size() * sizeof(Digest), offset);
+        offset += level.size() * sizeof(Digest);
+    }
+
+    PagedFileHeader header = {};
+    std::memcpy(header.magic, PAGED_FILE_MAGIC, sizeof(header.magic));
+    header.version = PAGED_FILE_VERSION;
+    header.hashId = Sha256Policy::hashId;
+    header.leafCount = leafCount;
+    header.pageSize = layout.getPageSize();
+    header.pagedLevels = layout.getPagedLevels();
+    header.topOffset = layout.getTopOffset();
+    std::copy(root.begin(), root.end(), header.root);
+    Digest checksum = headerChecksum(header);
+    std::copy(checksum.begin(), checksum.end(), header.headerChecksum);
+    writeAt(reinterpret_cast<const byte*>(&header), sizeof(header), 0);
+
+    ::close(fd);
+    fd = -1;
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("Cannot replace " + path);
+    }
+    finished = true;
+    return root;
+}
+
+// Fixed frames of one page each. Resident pages are found through a hash
+// table and kept on an intrusive list from most to least recently used; a
+// miss reuses the frame at the old end.
+class PagedMerkleTree::BufferPool {
+public:
+    BufferPool(int fd, size_t pageSize, size_t frameCount)
+        : fd(fd),
+          pageSize(pageSize),
+          frameCount(frameCount),
+          frames(new byte[frameCount * pageSize]),
+          framePages(frameCount),
+          older(frameCount),
+          newer(frameCount) {
+        table.reserve(frameCount);
+    }
+
+    size_t getFrameCount() const { return frameCount; }
+
+    bool contains(size_t page) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return table.count(page) != 0;
+    }
+
+    // Asks the kernel to start reading a page that is about to be needed.
+    void prefetch(size_t page) {
+        ::posix_fadvise(fd, off_t(pageOffset(page)), off_t(pageSize), POSIX_FADV_WILLNEED);
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.prefetches++;
+    }
+
+    Digest read(size_t page, size_t slot) {
+        Digest digest;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = table.find(page);
+            if (it != table.end()) {
+                stats.pageHits++;
+                touch(it->second);
+                std::memcpy(digest.data(), frameData(it->second) + slot * sizeof(Digest), sizeof(Digest));
+                return digest;
+            }
+        }
+
+        // The read happens unlocked so other proofs proceed meanwhile. If
+        // another thread loads the same page first, its copy is kept.
+        std::vector<byte> buffer(pageSize);
+        readAt(fd, buffer.data(), pageSize, pageOffset(page));
+        std::memcpy(digest.data(), buffer.data() + slot * sizeof(Digest), sizeof(Digest));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.pageReads++;
+        auto it = table.find(page);
+        if (it != table.end()) {
+            touch(it->second);
+            return digest;
+        }
+
+        size_t frame;
+        if (used < frameCount) {
+            frame = used++;
+        } else {
+            frame = oldest;
+            unlink(frame);
+            table.erase(framePages[frame]);
+            stats.evictions++;
+        }
+        std::memcpy(frameData(frame), buffer.data(), pageSize);
+        framePages[frame] = page;
+        table.emplace(page, frame);
+        pushNewest(frame);
+        return digest;
+    }
+
+    PageStats getStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    static constexpr size_t NONE = SIZE_MAX;
+
+    int fd;
+    size_t pageSize;
+    size_t frameCount;
+    std::unique_ptr<byte[]> frames;
+    std::vector<size_t> framePages;
+    std::vector<size_t> older;
+    std::vector<size_t> newer;
+    size_t newest = NONE;
+    size_t oldest = NONE;
+    size_t used = 0;
+    std::unordered_map<size_t, size_t> table;
+    PageStats stats;
+    std::mutex mutex;
+
+    uint64_t pageOffset(size_t page) const { return PAGED_FILE_BODY_OFFSET + uint64_t(page) * pageSize; }
+
+    byte* frameData(size_t frame) { return frames.get() + frame * pageSize; }
+
+    void unlink(size_t frame) {
+        (older[frame] == NONE ? oldest : newer[older[frame]]) = newer[frame];
+        (newer[frame] == NONE ? newest : older[newer[frame]]) = older[frame];
+    }
+
+    void pushNewest(size_t frame) {
+        older[frame] = newest;
+        newer[frame] = NONE;
+        (newest == NONE ? oldest : newer[newest]) = frame;
+        newest = frame;
+    }
+
+    void touch(size_t frame) {
+        if (frame != newest) {
+            unlink(frame);
+            pushNewest(frame);
+        }
+    }
+};
+
+PagedMerkleTree::PagedMerkleTree(const std::string& path, const PagedTreeOptions& options)
+    : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+    }
+
+    try {
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            throw std::runtime_error("Cannot stat " + path + ": " + std::strerror(errno));
+        }
+        uint64_t fileSize = info.st_size;
+        if (fileSize < sizeof(PagedFileHeader)) {
+            throw std::runtime_error(path + " is too small to be a page file.");
+        }
+
+        PagedFileHeader header;
+        readAt(fd, reinterpret_cast<byte*>(&header), sizeof(header), 0);
+        if (std::memcmp(header.magic, PAGED_FILE_MAGIC, sizeof(header.magic)) != 0) {
+            throw std::runtime_error(path + " is not a page file.");
+        }
+        if (header.version != PAGED_FILE_VERSION) {
+            throw std::runtime_error(path + " has unsupported page file version " + std::to_string(header.version));
+        }
+        Digest checksum = headerChecksum(header);
+        if (!std::equal(checksum.begin(), checksum.end(), header.headerChecksum)) {
+            throw std::runtime_error(path + " has a corrupt header.");
+        }
+        if (header.hashId != Sha256Policy::hashId) {
+            throw std::runtime_error(path + " uses hash id " + std::to_string(header.hashId) +
+                                     ", expected " + std::to_string(Sha256Policy::hashId));
+        }
+        try {
+            layout = PagedLayout(header.leafCount, header.pageSize, header.pagedLevels);
+        } catch (const std::invalid_argument&) {
+            throw std::runtime_error(path + " has an inconsistent layout.");
+        }
+        if (header.leafCount == 0 || header.topOffset != layout.getTopOffset() ||
+            fileSize < header.topOffset || fileSize - header.topOffset < layout.getTopSize()) {
+            throw std::runtime_error(path + " has an inconsistent size.");
+        }
+
+        size_t pinned = layout.getTopSize();
+        size_t minimum = pinned + layout.getBandCount() * layout.getPageSize();
+        if (options.memoryBudget < minimum) {
+            throw std::invalid_argument("Memory budget of " + std::to_string(options.memoryBudget) +
+                                        " bytes is below the " + std::to_string(minimum) + " that " + path +
+                                        " needs.");
+        }
+
+        uint64_t offset = header.topOffset;
+        for (size_t level = layout.getPagedLevels(); level < layout.getLevelCount(); level++) {
+            top.emplace_back(layout.getLevelSize(level));
+            readAt(fd, top.back()[0].data(), top.back().size() * sizeof(Digest), offset);
+            offset += top.back().size() * sizeof(Digest);
+        }
+        const Digest& root = top.back()[0];
+        if (!std::equal(root.begin(), root.end(), header.root)) {
+            throw std::runtime_error(path + " root does not match its header.");
+        }
+
+        size_t frames = std::min(layout.getPageCount(), (options.memoryBudget - pinned) / layout.getPageSize());
+        pool = std::make_unique<BufferPool>(fd, layout.getPageSize(), frames);
+
+        // A proof touches one page per band, so kernel readahead around it
+        // would only waste I/O.
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+PagedMerkleTree::~PagedMerkleTree() {
+    ::close(fd);
+}
+
+ByteArray PagedMerkleTree::getRootHash() const {
+    return digestToBytes(top.back()[0]);
+}
+
+size_t PagedMerkleTree::getPoolPages() const {
+    return pool->getFrameCount();
+}
+
+Digest PagedMerkleTree::getNodeHash(size_t level, size_t index) const {
+    if (level >= getLevelCount() || index >= layout.getLevelSize(level)) {
+        throw std::out_of_range("Node out of range");
+    }
+    return nodeAt(level, index);
+}
+
+Digest PagedMerkleTree::nodeAt(size_t level, size_t index) const {
+    if (level >= layout.getPagedLevels()) {
+        return top[level - layout.getPagedLevels()][index];
+    }
+    return pool->read(layout.pageOf(level, index), layout.slotOf(level, index));
+}
+
+std::vector<Digest> PagedMerkleTree::generateProof(size_t index) const {
+    if (index >= getLeafCount()) {
+        throw std::out_of_range("Index out of range");
+    }
+    MERKLE_PHASE(Phase::ProofGeneration);
+
+    // Missing pages are announced together so the kernel reads them in
+    // parallel instead of one after another.
+    size_t missing[64];
+    size_t missingCount = 0;
+    size_t lastPage = SIZE_MAX;
+    for (size_t level = 0; level < layout.getPagedLevels(); level++) {
+        size_t sibling = (index >> level) ^ 1;
+        if (sibling >= layout.getLevelSize(level)) {
+            continue;
+        }
+        size_t page = layout.pageOf(level, sibling);
+        if (page != lastPage && !pool->contains(page)) {
+            missing[missingCount++] = page;
+        }
+        lastPage = page;
+    }
+    if (missingCount > 1) {
+        for (size_t i = 0; i < missingCount; i++) {
+            pool->prefetch(missing[i]);
+        }
+    }
+
+    std::vector<Digest> proof;
+    proof.reserve(getLevelCount() - 1);
+    for (size_t level = 0; level + 1 < getLevelCount(); level++) {
+        size_t sibling = (index >> level) ^ 1;
+        if (sibling < layout.getLevelSize(level)) {
+            proof.push_back(nodeAt(level, sibling));
+        }
+    }
+    return proof;
+}
+
+PageStats PagedMerkleTree::getPageStats() const {
+    return pool->getStats();
+}
@@ -0,0 +1,219 @@
+// paged_merkle_tree.h
+#ifndef PAGED_MERKLE_TREE_H
+#define PAGED_MERKLE_TREE_H
+
+#include "hash.h"
+#include "leaf_input.h"
+#include "merkle_builder.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A SHA-256 tree too large for memory, split into two tiers:
+//
+//   - the top levels, from pagedLevels up to the root, are pinned in memory;
+//   - the levels below live in a page file and are read through a buffer
+//     pool of fixed-size pages with LRU eviction.
+//
+// The paged levels are stored in bands of bandHeight levels. One page holds,
+// for one band, every node of a perfect subtree except its root: the 2^h
+// nodes on the band's lowest level, then 2^(h-1) on the next, and so on up to
+// the two children of the root. Every sibling a proof needs within a band is
+// in the page of the path's node, so a proof reads one page per band, about
+// log2(n / pinned nodes) / log2(pageSize / 32) pages. A 4 KiB page holds 6
+// levels, and 2^32 leaves in a 1 GiB budget take 2 page reads per proof.
+//
+// Nodes, roots and proofs are those of MerkleTree over the same leaves.
+
+struct PagedTreeOptions {
+    // Bound on the pinned levels plus the buffer pool, in bytes. The writer
+    // pins as many top levels as fit in half of it.
+    size_t memoryBudget = size_t(256) << 20;
+
+    // A power of two from 512 bytes to 1 MiB, fixed when the file is written.
+    size_t pageSize = 4096;
+};
+
+// On-disk layout of a page file:
+//
+//   [0, sizeof(PagedFileHeader))  header, little-endian
+//   [bodyOffset, topOffset)       the pages of band 0, then band 1, ...; the
+//                                 pages of a band are ordered by subtree
+//   [topOffset, ...)              the pinned levels back to back, lowest first
+
+const char PAGED_FILE_MAGIC[8] = {'M', 'R', 'K', 'L', 'P', 'A', 'G', 'E'};
+const uint32_t PAGED_FILE_VERSION = 1;
+const uint64_t PAGED_FILE_BODY_OFFSET = 4096;
+
+struct PagedFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t hashId;          // HashPolicy::hashId of the tree (hash_policy.h)
+    uint64_t leafCount;
+    uint64_t pageSize;
+    uint64_t pagedLevels;
+    uint64_t topOffset;
+    byte root[32];
+    byte headerChecksum[32];  // SHA-256 of every header byte before this field
+};
+
+static_assert(sizeof(PagedFileHeader) == 112, "page file header must not contain padding");
+
+// Where each node of a tree lives in a page file.
+class PagedLayout {
+public:
+    PagedLayout() = default;
+
+    // Throws std::invalid_argument for an unsupported page size or
+    // pagedLevels >= the level count.
+    PagedLayout(size_t leafCount, size_t pageSize, size_t pagedLevels);
+
+    // Pages levels from the bottom, in whole bands, until the rest fits in
+    // pinnedBudget bytes.
+    static size_t choosePagedLevels(size_t leafCount, size_t pageSize, size_t pinnedBudget);
+
+    size_t getLevelCount() const { return levelSizes.size(); }
+
+    size_t getLevelSize(size_t level) const { return levelSizes[level]; }
+
+    size_t getPagedLevels() const { return pagedLevels; }
+
+    size_t getBandCount() const { return bandFirstPages.size() - 1; }
+
+    size_t getPageCount() const { return bandFirstPages.back(); }
+
+    size_t getPageSize() const { return pageSize; }
+
+    // The band a paged level belongs to.
+    size_t bandOf(size_t level) const { return level / bandHeight; }
+
+    // Bytes of the pinned levels.
+    size_t getTopSize() const;
+
+    uint64_t getTopOffset() const { return PAGED_FILE_BODY_OFFSET + uint64_t(getPageCount()) * pageSize; }
+
+    // The page and digest slot of a node on a paged level.
+    size_t pageOf(size_t level, size_t index) const;
+    size_t slotOf(size_t level, size_t index) const;
+
+    // Nodes stored in a page; only the last page of a band is partly empty.
+    size_t nodesInPage(size_t page) const;
+
+private:
+    std::vector<size_t> levelSizes;
+    std::vector<size_t> bandFirstPages;
+    size_t pageSize = 0;
+    size_t bandHeight = 0;
+    size_t pagedLevels = 0;
+
+    size_t heightOf(size_t band) const;
+};
+
+struct PageStats {
+    uint64_t pageReads = 0;   // pages read from the file into the pool
+    uint64_t pageHits = 0;    // lookups served by a resident page
+    uint64_t evictions = 0;
+    uint64_t prefetches = 0;  // read-ahead hints for missing proof pages
+};
+
+// Streams leaves into a new page file. Nodes are placed in their pages as the
+// builder produces them, so memory holds the pinned levels plus a few pages
+// per band. The file is written beside path and renamed by finish().
+class PagedTreeWriter {
+public:
+    // Throws std::invalid_argument for a zero leafCount or bad options.
+    PagedTreeWriter(const std::string& path, size_t leafCount, const PagedTreeOptions& options = {});
+    ~PagedTreeWriter();
+
+    PagedTreeWriter(const PagedTreeWriter&) = delete;
+    PagedTreeWriter& operator=(const PagedTreeWriter&) = delete;
+
+    // Throws std::logic_error past leafCount leaves.
+    void addLeaf(const LeafInput& leaf);
+    void addLeafHash(const Digest& leafHash);
+
+    // Throws std::logic_error unless exactly leafCount leaves were added.
+    ByteArray finish();
+
+private:
+    // A band's completed pages, which arrive in page order, gathered into
+    // one write.
+    struct PendingPages {
+        std::vector<byte> data;
+        size_t firstPage = 0;
+        size_t count = 0;
+    };
+
+    // A page whose nodes are still arriving.
+    struct OpenPage {
+        std::vector<byte> data;
+        size_t filled = 0;
+    };
+
+    std::string path;
+    std::string temporaryPath;
+    int fd;
+    PagedLayout layout;
+    size_t leafCount;
+    MerkleTreeBuilder builder;
+    std::vector<std::vector<Digest>> top;
+    std::vector<std::vector<std::pair<size_t, OpenPage>>> openPages;
+    std::vector<PendingPages> pending;
+    bool finished = false;
+
+    void place(size_t level, size_t index, const Digest& digest);
+    void completePage(size_t band, size_t page, std::vector<byte>& data);
+    void flush(PendingPages& run);
+    void writeAt(const byte* data, size_t size, uint64_t offset);
+};
+
+// A read-only tree opened from a page file. Safe for concurrent proofs: the
+// buffer pool is shared, and page reads happen outside its lock.
+class PagedMerkleTree {
+public:
+    // Throws std::runtime_error for a missing or corrupt file and
+    // std::invalid_argument if the pinned levels and one page per band do
+    // not fit in options.memoryBudget. options.pageSize is taken from the file.
+    explicit PagedMerkleTree(const std::string& path, const PagedTreeOptions& options = {});
+    ~PagedMerkleTree();
+
+    PagedMerkleTree(const PagedMerkleTree&) = delete;
+    PagedMerkleTree& operator=(const PagedMerkleTree&) = delete;
+
+    ByteArray getRootHash() const;
+
+    size_t getLeafCount() const { return layout.getLevelSize(0); }
+
+    size_t getLevelCount() const { return layout.getLevelCount(); }
+
+    size_t getPagedLevels() const { return layout.getPagedLevels(); }
+
+    // Pages a proof may read: one per band.
+    size_t getPagesPerProof() const { return layout.getBandCount(); }
+
+    size_t getPoolPages() const;
+
+    // Throws std::out_of_range outside the tree.
+    Digest getNodeHash(size_t level, size_t index) const;
+
+    // Siblings bottom-up, as MerkleTree::generateProof() and accepted by
+    // MerkleTree::verifyProof(). The pages on the path are hinted to the
+    // kernel together before the first is read. Throws std::out_of_range for
+    // a bad index.
+    std::vector<Digest> generateProof(size_t index) const;
+
+    PageStats getPageStats() const;
+
+private:
+    class BufferPool;
+
+    int fd;
+    PagedLayout layout;
+    std::vector<std::vector<Digest>> top;
+    std::unique_ptr<BufferPool> pool;
+
+    Digest nodeAt(size_t level, size_t index) const;
+};
+
+#endif // PAGED_MERKLE_TREE_H
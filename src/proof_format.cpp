@@ -0,0 +1,86 @@
+// proof_format.cpp
+#include "proof_format.h"
+#include "stats.h"
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+static_assert(std::endian::native == std::endian::little, "proofs are encoded little-endian");
+
+namespace {
+
+void writeHeader(uint32_t hashId, size_t leafIndex, size_t treeSize, size_t siblingCount, byte* out) {
+    ProofHeader header = {};
+    header.version = PROOF_FORMAT_VERSION;
+    header.hashId = uint8_t(hashId);
+    header.siblingCount = uint16_t(siblingCount);
+    header.leafIndex = leafIndex;
+    header.treeSize = treeSize;
+    std::memcpy(out, &header, sizeof(header));
+}
+
+} // namespace
+
+size_t encodeProof(uint32_t hashId, size_t leafIndex, size_t treeSize,
+                   std::span<const Digest> siblings, std::span<byte> out) {
+    if (hashId > UINT8_MAX || siblings.size() > UINT16_MAX) {
+        throw std::invalid_argument("Proof header holds a hash id up to 255 and up to 65535 siblings.");
+    }
+    size_t size = encodedProofSize(siblings.size());
+    if (out.size() < size) {
+        return 0;
+    }
+    writeHeader(hashId, leafIndex, treeSize, siblings.size(), out.data());
+    std::memcpy(out.data() + sizeof(ProofHeader), siblings.data(), siblings.size_bytes());
+    return size;
+}
+
+template <typename HashPolicy>
+size_t BasicMerkleTree<HashPolicy>::encodeProof(size_t index, std::span<byte> out) const {
+    if (index >= numLeaves) {
+        throw std::out_of_range("Index out of range");
+    }
+
+    MERKLE_PHASE(Phase::ProofGeneration);
+
+    // Siblings are copied straight from the level storage into the buffer.
+    size_t siblingCount = 0;
+    size_t currentIndex = index;
+    for (size_t level = 0; level + 1 < levelCount; level++) {
+        size_t siblingIndex = currentIndex ^ 1;
+        if (siblingIndex < levelSize(level)) {
+            if (out.size() < encodedProofSize(siblingCount + 1)) {
+                return 0;
+            }
+            std::memcpy(out.data() + encodedProofSize(siblingCount), &nodeAt(level, siblingIndex), sizeof(Digest));
+            siblingCount++;
+        }
+        currentIndex /= 2;
+    }
+
+    if (out.size() < sizeof(ProofHeader)) {
+        return 0;
+    }
+    writeHeader(HashPolicy::hashId, index, numLeaves, siblingCount, out.data());
+    return encodedProofSize(siblingCount);
+}
+
+std::optional<ProofView> ProofView::parse(std::span<const byte> bytes) {
+    if (bytes.size() < sizeof(ProofHeader)) {
+        return std::nullopt;
+    }
+
+    ProofView view;
+    std::memcpy(&view.header, bytes.data(), sizeof(ProofHeader));
+    if (view.header.version != PROOF_FORMAT_VERSION || view.header.reserved != 0 ||
+        bytes.size() != encodedProofSize(view.header.siblingCount)) {
+        return std::nullopt;
+    }
+
+    view.siblings = std::span<const Digest>(reinterpret_cast<const Digest*>(bytes.data() + sizeof(ProofHeader)),
+                                            view.header.siblingCount);
+    return view;
+}
+
+template size_t MerkleTree::encodeProof(size_t, std::span<byte>) const;
+template size_t Blake3MerkleTree::encodeProof(size_t, std::span<byte>) const;
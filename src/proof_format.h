@@ -0,0 +1,72 @@
+// proof_format.h
+#ifndef PROOF_FORMAT_H
+#define PROOF_FORMAT_H
+
+#include "merkle_tree.h"
+#include <cstdint>
+#include <optional>
+#include <span>
+
+// Wire layout of one inclusion proof, written by MerkleTree::encodeProof():
+//
+//   [0, sizeof(ProofHeader))      header, little-endian
+//   [sizeof(ProofHeader), ...)    siblingCount digests of 32 bytes, bottom-up
+//
+// Digests are byte arrays, so a received buffer is used in place at any
+// alignment.
+
+const uint8_t PROOF_FORMAT_VERSION = 1;
+
+struct ProofHeader {
+    uint8_t version;
+    uint8_t hashId;          // HashPolicy::hashId of the tree (hash_policy.h)
+    uint16_t siblingCount;
+    uint32_t reserved;       // zero
+    uint64_t leafIndex;
+    uint64_t treeSize;       // leaves in the tree the proof was made for
+};
+
+static_assert(sizeof(ProofHeader) == 24, "proof header must not contain padding");
+
+inline size_t encodedProofSize(size_t siblingCount) {
+    return sizeof(ProofHeader) + siblingCount * sizeof(Digest);
+}
+
+// Writes a proof from its parts. Returns the bytes written, or 0 if out is
+// shorter than encodedProofSize(siblings.size()). Throws
+// std::invalid_argument if hashId or the sibling count does not fit its
+// header field.
+size_t encodeProof(uint32_t hashId, size_t leafIndex, size_t treeSize,
+                   std::span<const Digest> siblings, std::span<byte> out);
+
+// A parsed view of an encoded proof. It points into the received bytes, which
+// must outlive it; parsing and verifying neither allocate nor copy.
+class ProofView {
+public:
+    // Checks the version, the reserved field and that bytes holds exactly the
+    // announced digests. Returns nothing for malformed input.
+    static std::optional<ProofView> parse(std::span<const byte> bytes);
+
+    uint32_t getHashId() const { return header.hashId; }
+
+    size_t getLeafIndex() const { return header.leafIndex; }
+
+    size_t getTreeSize() const { return header.treeSize; }
+
+    std::span<const Digest> getSiblings() const { return siblings; }
+
+    // Verifies leafData against rootHash with the index and tree size carried
+    // in the proof. Fails if the proof was made with another hash policy.
+    template <typename HashPolicy = Sha256Policy>
+    bool verify(const Digest& rootHash, std::span<const byte> leafData) const {
+        return header.hashId == HashPolicy::hashId &&
+               BasicMerkleTree<HashPolicy>::verifyProof(rootHash, leafData, siblings,
+                                                        header.leafIndex, header.treeSize);
+    }
+
+private:
+    ProofHeader header;
+    std::span<const Digest> siblings;
+};
+
+#endif // PROOF_FORMAT_H
@@ -0,0 +1,687 @@
+// proof_server.cpp
+#include "proof_server.h"
+#include "proof_format.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static_assert(std::endian::native == std::endian::little, "server frames are little-endian");
+
+namespace {
+
+// Bytes read from one connection per wakeup, so one busy client cannot
+// starve the others.
+const size_t READ_CHUNK = 64 * 1024;
+const size_t MAX_READ_PER_WAKEUP = 1 << 20;
+
+// A connection whose unsent responses exceed this is not read from until the
+// client catches up.
+const size_t MAX_PENDING_OUTPUT = 16 << 20;
+
+const size_t MAX_IOVECS = 256;
+const size_t MAX_EVENTS = 256;
+
+// Requests a client keeps in flight in getProofs().
+const size_t CLIENT_WINDOW = 256;
+
+std::string errorText(const std::string& what) {
+    return what + ": " + std::strerror(errno);
+}
+
+sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path must be 1 to " + std::to_string(sizeof(address.sun_path) - 1) +
+                                    " bytes long");
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+void writeFrameHeader(byte* header, uint8_t op, uint64_t id, size_t payloadSize) {
+    uint32_t length = uint32_t(1 + sizeof(id) + payloadSize);
+    std::memcpy(header, &length, sizeof(length));
+    header[4] = op;
+    std::memcpy(header + 5, &id, sizeof(id));
+}
+
+size_t bucketOf(uint64_t ns) {
+    if (ns < 8) {
+        return ns;
+    }
+    size_t exponent = std::bit_width(ns) - 1;
+    return 8 + (exponent - 3) * 8 + ((ns >> (exponent - 3)) & 7);
+}
+
+uint64_t bucketUpperBound(size_t bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    size_t exponent = (bucket - 8) / 8 + 3;
+    uint64_t mantissa = 8 + (bucket - 8) % 8;
+    return ((mantissa + 1) << (exponent - 3)) - 1;
+}
+
+} // namespace
+
+void LatencyHistogram::record(uint64_t ns) {
+    buckets[bucketOf(ns)]++;
+    count++;
+    max = std::max(max, ns);
+}
+
+uint64_t LatencyHistogram::quantile(double q) const {
+    uint64_t target = std::max<uint64_t>(1, uint64_t(q * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= target) {
+            return std::min(bucketUpperBound(b), max);
+        }
+    }
+    return 0;
+}
+
+ProofServer::ProofServer(const MerkleTree& tree, const std::string& socketPath, size_t threadCount)
+    : tree(tree), root(tree.getNodeHash(tree.getLevelCount() - 1, 0)), socketPath(socketPath),
+      pool(threadCount), startTime(std::chrono::steady_clock::now()) {
+    sockaddr_un address = socketAddress(socketPath);
+
+    try {
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) {
+            throw std::runtime_error(errorText("Cannot create proof server socket"));
+        }
+        ::unlink(socketPath.c_str());
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            throw std::runtime_error(errorText("Cannot bind " + socketPath));
+        }
+        if (::listen(listenFd, SOMAXCONN) < 0) {
+            throw std::runtime_error(errorText("Cannot listen on " + socketPath));
+        }
+
+        epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0) {
+            throw std::runtime_error(errorText("Cannot create proof server event loop"));
+        }
+        for (int fd : {listenFd, wakeFd}) {
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+                throw std::runtime_error(errorText("Cannot register with epoll"));
+            }
+        }
+    } catch (...) {
+        for (int fd : {listenFd, epollFd, wakeFd}) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        throw;
+    }
+}
+
+ProofServer::~ProofServer() {
+    for (auto& entry : connections) {
+        ::close(entry.first);
+    }
+    ::close(wakeFd);
+    ::close(epollFd);
+    ::close(listenFd);
+    ::unlink(socketPath.c_str());
+}
+
+void ProofServer::run() {
+    std::vector<epoll_event> events(MAX_EVENTS);
+    std::vector<Connection*> active;
+
+    while (true) {
+        int ready = ::epoll_wait(epollFd, events.data(), int(events.size()), -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(errorText("Proof server epoll_wait failed"));
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        bool stopping = false;
+        active.clear();
+
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd) {
+                stopping = true;
+                continue;
+            }
+            if (fd == listenFd) {
+                acceptConnections();
+                continue;
+            }
+            auto found = connections.find(fd);
+            if (found == connections.end()) {
+                continue;
+            }
+            Connection& connection = *found->second;
+            if (events[i].events & EPOLLIN) {
+                readConnection(connection);
+                parseRequests(connection, now);
+            }
+            if (events[i].events & EPOLLHUP) {
+                // Nothing more will arrive; a peer that is gone entirely
+                // fails the next send.
+                connection.readClosed = true;
+            }
+            if (events[i].events & EPOLLERR) {
+                connection.closing = true;
+            }
+            active.push_back(&connection);
+        }
+
+        // Requests point into the connections' input buffers, so those are
+        // only compacted and closed once the batch is answered. Requests
+        // already read are answered even when stopping.
+        processBatch();
+
+        for (Connection* connection : active) {
+            flush(*connection);
+            connection->input.erase(connection->input.begin(), connection->input.begin() + connection->parsed);
+            connection->parsed = 0;
+        }
+        for (Connection* connection : active) {
+            // A half-closed connection stays open, waiting on EPOLLOUT, until
+            // its last response is written.
+            if (connection->closing || (connection->readClosed && connection->output.empty())) {
+                closeConnection(connection->fd);
+            }
+        }
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void ProofServer::stop() {
+    uint64_t one = 1;
+    ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+    (void)ignored;
+}
+
+ServerStats ProofServer::getStats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    ServerStats stats;
+    stats.requests = latency.getCount();
+    stats.batches = batches;
+    stats.uptimeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    stats.requestsPerSecond = stats.uptimeSeconds > 0 ? stats.requests / stats.uptimeSeconds : 0;
+    stats.p50Ns = latency.quantile(0.5);
+    stats.p99Ns = latency.quantile(0.99);
+    stats.maxNs = latency.getMax();
+    return stats;
+}
+
+void ProofServer::acceptConnections() {
+    while (true) {
+        int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EAGAIN once the backlog is drained; anything else (EMFILE, a
+            // client that already left) only affects that one connection.
+            return;
+        }
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            ::close(fd);
+            continue;
+        }
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        connection->interest = EPOLLIN;
+        connections[fd] = std::move(connection);
+    }
+}
+
+void ProofServer::readConnection(Connection& connection) {
+    size_t received = 0;
+    while (received < MAX_READ_PER_WAKEUP) {
+        size_t used = connection.input.size();
+        connection.input.resize(used + READ_CHUNK);
+        ssize_t n = ::read(connection.fd, connection.input.data() + used, READ_CHUNK);
+        connection.input.resize(used + std::max<ssize_t>(n, 0));
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n == 0) {
+            // End of stream: answer what already arrived, then close.
+            connection.readClosed = true;
+            return;
+        }
+        if (n < 0) {
+            connection.closing = true;
+            return;
+        }
+        received += n;
+        if (size_t(n) < READ_CHUNK) {
+            return;
+        }
+    }
+}
+
+void ProofServer::parseRequests(Connection& connection, std::chrono::steady_clock::time_point now) {
+    const ByteArray& input = connection.input;
+    while (input.size() - connection.parsed >= sizeof(uint32_t)) {
+        const byte* frame = input.data() + connection.parsed;
+        uint32_t length;
+        std::memcpy(&length, frame, sizeof(length));
+        if (length < FRAME_HEADER_SIZE - sizeof(length) || length > MAX_FRAME_SIZE) {
+            // The stream cannot be resynchronised after a bad length.
+            connection.closing = true;
+            return;
+        }
+        if (input.size() - connection.parsed < sizeof(length) + length) {
+            return;
+        }
+
+        Request request;
+        request.connection = &connection;
+        request.op = ProofOp(frame[4]);
+        std::memcpy(&request.id, frame + 5, sizeof(request.id));
+        request.payload = std::span<const byte>(frame + FRAME_HEADER_SIZE, length - (FRAME_HEADER_SIZE - sizeof(length)));
+        request.arrival = now;
+        batch.push_back(std::move(request));
+        connection.parsed += sizeof(length) + length;
+    }
+}
+
+void ProofServer::processBatch() {
+    if (batch.empty()) {
+        return;
+    }
+
+    size_t leafCount = tree.getLeafCount();
+    std::vector<size_t> proofRequests;
+    std::vector<size_t> verifyRequests;
+    std::vector<ProofCheck> checks;
+    std::vector<uint8_t> status(batch.size(), uint8_t(ProofStatus::Ok));
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        Request& request = batch[i];
+        ByteArray& payload = request.response.payload;
+
+        switch (request.op) {
+        case ProofOp::Root:
+            payload.assign(root.begin(), root.end());
+            break;
+
+        case ProofOp::Stats: {
+            std::string json = statsJson();
+            payload.assign(json.begin(), json.end());
+            break;
+        }
+
+        case ProofOp::Proof: {
+            uint64_t index;
+            if (request.payload.size() != sizeof(index)) {
+                status[i] = uint8_t(ProofStatus::BadRequest);
+                break;
+            }
+            std::memcpy(&index, request.payload.data(), sizeof(index));
+            if (index >= leafCount) {
+                status[i] = uint8_t(ProofStatus::BadRequest);
+                break;
+            }
+            proofRequests.push_back(i);
+            break;
+        }
+
+        case ProofOp::Verify: {
+            uint32_t proofSize;
+            if (request.payload.size() < sizeof(proofSize)) {
+                status[i] = uint8_t(ProofStatus::BadRequest);
+                break;
+            }
+            std::memcpy(&proofSize, request.payload.data(), sizeof(proofSize));
+            if (request.payload.size() - sizeof(proofSize) < proofSize) {
+                status[i] = uint8_t(ProofStatus::BadRequest);
+                break;
+            }
+            std::optional<ProofView> view = ProofView::parse(request.payload.subspan(sizeof(proofSize), proofSize));
+            if (!view) {
+                status[i] = uint8_t(ProofStatus::BadRequest);
+                break;
+            }
+            // A well-formed proof for another hash or tree shape is simply
+            // not valid against this root.
+            payload.assign(1, 0);
+            if (view->getHashId() == Sha256Policy::hashId && view->getTreeSize() == leafCount &&
+                view->getLeafIndex() < leafCount) {
+                checks.push_back({request.payload.subspan(sizeof(proofSize) + proofSize), view->getSiblings(),
+                                  view->getLeafIndex()});
+                verifyRequests.push_back(i);
+            }
+            break;
+        }
+
+        default:
+            status[i] = uint8_t(ProofStatus::BadRequest);
+            break;
+        }
+    }
+
+    if (!proofRequests.empty()) {
+        size_t maxSize = encodedProofSize(tree.getLevelCount() - 1);
+        pool.parallelFor(0, proofRequests.size(), 64, [&](size_t first, size_t last) {
+            for (size_t k = first; k < last; k++) {
+                Request& request = batch[proofRequests[k]];
+                uint64_t index;
+                std::memcpy(&index, request.payload.data(), sizeof(index));
+                ByteArray& payload = request.response.payload;
+                payload.resize(maxSize);
+                payload.resize(tree.encodeProof(index, payload));
+            }
+        });
+    }
+
+    if (!checks.empty()) {
+        ProofBitmap valid = MerkleTree::verifyBatch(root, checks, leafCount, &pool);
+        for (size_t k = 0; k < verifyRequests.size(); k++) {
+            batch[verifyRequests[k]].response.payload[0] = valid.test(k) ? 1 : 0;
+        }
+    }
+
+    auto done = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        batches++;
+        for (const Request& request : batch) {
+            latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(done - request.arrival).count());
+        }
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        Request& request = batch[i];
+        if (status[i] != uint8_t(ProofStatus::Ok)) {
+            request.response.payload.clear();
+        }
+        writeFrameHeader(request.response.header, status[i], request.id, request.response.payload.size());
+        queueResponse(request);
+    }
+    batch.clear();
+}
+
+void ProofServer::queueResponse(Request& request) {
+    Connection& connection = *request.connection;
+    connection.pendingBytes += FRAME_HEADER_SIZE + request.response.payload.size();
+    connection.output.push_back(std::move(request.response));
+}
+
+void ProofServer::flush(Connection& connection) {
+    while (connection.outputStart < connection.output.size()) {
+        // Header and payload of each response are separate buffers; the
+        // kernel gathers them, so nothing is copied into a send buffer here.
+        iovec iovecs[MAX_IOVECS];
+        size_t count = 0;
+        size_t skip = connection.sentBytes;
+        size_t offered = 0;
+        auto add = [&](const byte* data, size_t size) {
+            if (skip >= size) {
+                skip -= size;
+                return;
+            }
+            iovecs[count++] = {const_cast<byte*>(data) + skip, size - skip};
+            offered += size - skip;
+            skip = 0;
+        };
+        for (size_t k = connection.outputStart; k < connection.output.size() && count + 2 <= MAX_IOVECS; k++) {
+            const Response& response = connection.output[k];
+            add(response.header, FRAME_HEADER_SIZE);
+            if (!response.payload.empty()) {
+                add(response.payload.data(), response.payload.size());
+            }
+        }
+
+        msghdr message = {};
+        message.msg_iov = iovecs;
+        message.msg_iovlen = count;
+        ssize_t n = ::sendmsg(connection.fd, &message, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection.closing = true;
+                connection.output.clear();
+                connection.outputStart = 0;
+                connection.sentBytes = 0;
+                connection.pendingBytes = 0;
+            }
+            break;
+        }
+
+        connection.pendingBytes -= n;
+        size_t written = n;
+        while (written > 0) {
+            size_t left = FRAME_HEADER_SIZE + connection.output[connection.outputStart].payload.size() - connection.sentBytes;
+            if (written < left) {
+                connection.sentBytes += written;
+                break;
+            }
+            written -= left;
+            connection.outputStart++;
+            connection.sentBytes = 0;
+        }
+        if (size_t(n) < offered) {
+            break;
+        }
+    }
+
+    if (connection.outputStart == connection.output.size()) {
+        connection.output.clear();
+        connection.outputStart = 0;
+    }
+    updateInterest(connection);
+}
+
+void ProofServer::updateInterest(Connection& connection) {
+    uint32_t interest = 0;
+    if (!connection.readClosed && connection.pendingBytes < MAX_PENDING_OUTPUT) {
+        interest |= EPOLLIN;
+    }
+    if (connection.outputStart < connection.output.size()) {
+        interest |= EPOLLOUT;
+    }
+    if (interest == connection.interest || connection.closing) {
+        return;
+    }
+    epoll_event event = {};
+    event.events = interest;
+    event.data.fd = connection.fd;
+    if (::epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event) < 0) {
+        connection.closing = true;
+        return;
+    }
+    connection.interest = interest;
+}
+
+void ProofServer::closeConnection(int fd) {
+    ::epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    connections.erase(fd);
+}
+
+std::string ProofServer::statsJson() const {
+    ServerStats stats = getStats();
+    std::ostringstream out;
+    out << "{\"requests\": " << stats.requests << ", \"batches\": " << stats.batches
+        << ", \"uptime_s\": " << stats.uptimeSeconds << ", \"requests_per_s\": " << stats.requestsPerSecond
+        << ", \"p50_ns\": " << stats.p50Ns << ", \"p99_ns\": " << stats.p99Ns << ", \"max_ns\": " << stats.maxNs
+        << "}";
+    return out.str();
+}
+
+ProofClient::ProofClient(const std::string& socketPath) {
+    sockaddr_un address = socketAddress(socketPath);
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error(errorText("Cannot create proof client socket"));
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        std::string message = errorText("Cannot connect to " + socketPath);
+        ::close(fd);
+        throw std::runtime_error(message);
+    }
+}
+
+ProofClient::~ProofClient() {
+    ::close(fd);
+}
+
+Digest ProofClient::getRootHash() {
+    uint64_t id = nextId++;
+    ByteArray request;
+    appendRequest(request, ProofOp::Root, id, {});
+    send(request);
+    ByteArray payload = receive(id);
+    if (payload.size() != sizeof(Digest)) {
+        throw std::runtime_error("Proof server sent a malformed root.");
+    }
+    Digest root;
+    std::memcpy(root.data(), payload.data(), root.size());
+    return root;
+}
+
+ByteArray ProofClient::getProof(size_t index) {
+    return getProofs(std::span<const size_t>(&index, 1))[0];
+}
+
+std::vector<ByteArray> ProofClient::getProofs(std::span<const size_t> indices) {
+    std::vector<ByteArray> proofs;
+    proofs.reserve(indices.size());
+    ByteArray request;
+    for (size_t first = 0; first < indices.size(); first += CLIENT_WINDOW) {
+        size_t last = std::min(indices.size(), first + CLIENT_WINDOW);
+        uint64_t firstId = nextId;
+        request.clear();
+        for (size_t i = first; i < last; i++) {
+            uint64_t index = indices[i];
+            appendRequest(request, ProofOp::Proof, nextId++,
+                          std::span<const byte>(reinterpret_cast<const byte*>(&index), sizeof(index)));
+        }
+        send(request);
+        for (size_t i = first; i < last; i++) {
+            proofs.push_back(receive(firstId + (i - first)));
+        }
+    }
+    return proofs;
+}
+
+bool ProofClient::verifyProof(std::span<const byte> encodedProof, std::span<const byte> leafData) {
+    uint64_t id = nextId++;
+    ByteArray payload(sizeof(uint32_t) + encodedProof.size() + leafData.size());
+    uint32_t proofSize = uint32_t(encodedProof.size());
+    std::memcpy(payload.data(), &proofSize, sizeof(proofSize));
+    std::copy(encodedProof.begin(), encodedProof.end(), payload.begin() + sizeof(proofSize));
+    std::copy(leafData.begin(), leafData.end(), payload.begin() + sizeof(proofSize) + encodedProof.size());
+
+    ByteArray request;
+    appendRequest(request, ProofOp::Verify, id, payload);
+    send(request);
+    ByteArray reply = receive(id);
+    if (reply.size() != 1) {
+        throw std::runtime_error("Proof server sent a malformed verify reply.");
+    }
+    return reply[0] == 1;
+}
+
+std::string ProofClient::getStats() {
+    uint64_t id = nextId++;
+    ByteArray request;
+    appendRequest(request, ProofOp::Stats, id, {});
+    send(request);
+    ByteArray payload = receive(id);
+    return std::string(payload.begin(), payload.end());
+}
+
+void ProofClient::appendRequest(ByteArray& out, ProofOp op, uint64_t id, std::span<const byte> payload) {
+    if (FRAME_HEADER_SIZE - sizeof(uint32_t) + payload.size() > MAX_FRAME_SIZE) {
+        throw std::invalid_argument("Proof server request too large");
+    }
+    size_t start = out.size();
+    out.resize(start + FRAME_HEADER_SIZE + payload.size());
+    writeFrameHeader(out.data() + start, uint8_t(op), id, payload.size());
+    std::copy(payload.begin(), payload.end(), out.begin() + start + FRAME_HEADER_SIZE);
+}
+
+void ProofClient::send(const ByteArray& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error(errorText("Proof client write failed"));
+        }
+        done += n;
+    }
+}
+
+ByteArray ProofClient::receive(uint64_t expectedId) {
+    auto readExact = [&](byte* data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::read(fd, data + done, size - done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                throw std::runtime_error(errorText("Proof client read failed"));
+            }
+            if (n == 0) {
+                throw std::runtime_error("Proof server closed the connection.");
+            }
+            done += n;
+        }
+    };
+
+    byte header[FRAME_HEADER_SIZE];
+    readExact(header, sizeof(header));
+    uint32_t length;
+    uint64_t id;
+    std::memcpy(&length, header, sizeof(length));
+    std::memcpy(&id, header + 5, sizeof(id));
+    if (length < FRAME_HEADER_SIZE - sizeof(length) || length > MAX_FRAME_SIZE) {
+        throw std::runtime_error("Proof server sent a malformed frame.");
+    }
+
+    ByteArray payload(length - (FRAME_HEADER_SIZE - sizeof(length)));
+    readExact(payload.data(), payload.size());
+    if (id != expectedId) {
+        throw std::runtime_error("Proof server answered out of order.");
+    }
+    if (header[4] != uint8_t(ProofStatus::Ok)) {
+        throw std::runtime_error("Proof server rejected request " + std::to_string(id));
+    }
+    return payload;
+}
@@ -0,0 +1,190 @@
+// proof_server.h
+#ifndef PROOF_SERVER_H
+#define PROOF_SERVER_H
+
+#include "merkle_tree.h"
+#include "thread_pool.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Wire protocol on the server's Unix stream socket, little-endian. Requests
+// and responses share one framing:
+//
+//   u32 length    bytes after this field
+//   u8  op        request: ProofOp; response: ProofStatus
+//   u64 id        chosen by the client, echoed in the response
+//   payload
+//
+// Request payloads: Root and Stats none, Proof a u64 leaf index, Verify a u32
+// proof size followed by an encoded proof (proof_format.h) and the leaf data.
+// Response payloads: Root the 32-byte root, Proof an encoded proof, Verify one
+// byte (1 if valid), Stats a JSON object. Responses on one connection come in
+// request order. A client may shut down its write side after the last request
+// and still receives every response before the server closes.
+
+enum class ProofOp : uint8_t {
+    Root = 1,
+    Proof = 2,
+    Verify = 3,
+    Stats = 4,
+};
+
+enum class ProofStatus : uint8_t {
+    Ok = 0,
+    BadRequest = 1,
+};
+
+const size_t FRAME_HEADER_SIZE = 4 + 1 + 8;
+const uint32_t MAX_FRAME_SIZE = 1 << 20;
+
+struct ServerStats {
+    uint64_t requests = 0;
+    uint64_t batches = 0;
+    double uptimeSeconds = 0;
+    double requestsPerSecond = 0;  // over the whole uptime
+    uint64_t p50Ns = 0;            // from a request being read to its response being queued
+    uint64_t p99Ns = 0;
+    uint64_t maxNs = 0;
+};
+
+// Latency histogram with eight sub-buckets per power of two, so quantiles are
+// within 12.5% of the true value.
+class LatencyHistogram {
+public:
+    void record(uint64_t ns);
+
+    // Upper bound of the bucket holding quantile q (0 < q <= 1).
+    uint64_t quantile(double q) const;
+
+    uint64_t getCount() const { return count; }
+
+    uint64_t getMax() const { return max; }
+
+private:
+    static const size_t BUCKETS = 8 + 61 * 8;
+
+    std::array<uint64_t, BUCKETS> buckets = {};
+    uint64_t count = 0;
+    uint64_t max = 0;
+};
+
+// Serves one tree over a Unix socket. A single thread runs an epoll loop; every
+// request that arrives in one wakeup joins a batch. Proof requests in the
+// batch are encoded and verify requests checked with verifyBatch(), both
+// spread over the worker pool, and each connection's responses go out in one
+// writev() of header and payload buffers. Under load more requests queue up
+// while a batch runs, so batches grow with the request rate.
+class ProofServer {
+public:
+    // The tree must outlive the server. Removes a stale socket file first.
+    ProofServer(const MerkleTree& tree, const std::string& socketPath, size_t threadCount = 0);
+
+    ~ProofServer();
+
+    ProofServer(const ProofServer&) = delete;
+    ProofServer& operator=(const ProofServer&) = delete;
+
+    // Runs the event loop until stop().
+    void run();
+
+    // Safe to call from any thread and from a signal handler.
+    void stop();
+
+    ServerStats getStats() const;
+
+private:
+    struct Response {
+        byte header[FRAME_HEADER_SIZE];
+        ByteArray payload;
+    };
+
+    struct Connection {
+        int fd;
+        ByteArray input;
+        size_t parsed = 0;          // input bytes already turned into requests
+        std::vector<Response> output;
+        size_t outputStart = 0;     // first response not fully written
+        size_t sentBytes = 0;       // bytes of that response already written
+        size_t pendingBytes = 0;
+        bool readClosed = false;    // end of stream seen: answer what arrived, then close
+        bool closing = false;       // torn down after this wakeup, output or not
+        uint32_t interest = 0;
+    };
+
+    struct Request {
+        Connection* connection;
+        ProofOp op;
+        uint64_t id;
+        std::span<const byte> payload;
+        std::chrono::steady_clock::time_point arrival;
+        Response response;
+    };
+
+    const MerkleTree& tree;
+    Digest root;
+    std::string socketPath;
+    ThreadPool pool;
+
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::vector<Request> batch;
+
+    std::chrono::steady_clock::time_point startTime;
+    mutable std::mutex statsMutex;
+    LatencyHistogram latency;
+    uint64_t batches = 0;
+
+    void acceptConnections();
+    void readConnection(Connection& connection);
+    void parseRequests(Connection& connection, std::chrono::steady_clock::time_point now);
+    void processBatch();
+    void queueResponse(Request& request);
+    void flush(Connection& connection);
+    void updateInterest(Connection& connection);
+    void closeConnection(int fd);
+    std::string statsJson() const;
+};
+
+// Blocking client for ProofServer. Throws std::runtime_error on I/O errors
+// and on responses with a non-Ok status.
+class ProofClient {
+public:
+    explicit ProofClient(const std::string& socketPath);
+
+    ~ProofClient();
+
+    ProofClient(const ProofClient&) = delete;
+    ProofClient& operator=(const ProofClient&) = delete;
+
+    Digest getRootHash();
+
+    // The proof in the binary proof format (proof_format.h).
+    ByteArray getProof(size_t index);
+
+    // Pipelined: requests go out in windows without waiting for each reply.
+    std::vector<ByteArray> getProofs(std::span<const size_t> indices);
+
+    bool verifyProof(std::span<const byte> encodedProof, std::span<const byte> leafData);
+
+    std::string getStats();
+
+private:
+    int fd;
+    uint64_t nextId = 1;
+
+    void appendRequest(ByteArray& out, ProofOp op, uint64_t id, std::span<const byte> payload);
+    void send(const ByteArray& data);
+    ByteArray receive(uint64_t expectedId);
+};
+
+#endif // PROOF_SERVER_H
@@ -0,0 +1,152 @@
+// server.cpp - proof daemon serving one tree over a Unix socket
+#include "proof_server.h"
+#include <condition_variable>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+
+struct ServerOptions {
+    std::string socketPath;
+    std::string treePath;
+    size_t syntheticLeaves = 0;
+    size_t threads = 0;
+    double statsInterval = 0;
+};
+
+ProofServer* runningServer = nullptr;
+
+void handleSignal(int) {
+    if (runningServer != nullptr) {
+        runningServer->stop();
+    }
+}
+
+void printUsage() {
+    std::cout << "usage: merkle_server --socket PATH (--tree FILE | --synthetic N) [options]\n"
+              << "  --socket PATH        Unix socket to listen on\n"
+              << "  --tree FILE          serve a tree saved with MerkleTree::save()\n"
+              << "  --synthetic N        serve a tree over N generated leaves \"leaf-<i>\"\n"
+              << "  --threads N          worker threads (default: every hardware thread)\n"
+              << "  --stats-interval S   print throughput and latency every S seconds\n";
+}
+
+ServerOptions parseOptions(int argc, char** argv) {
+    ServerOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage();
+            std::exit(0);
+        }
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("Missing value for " + arg);
+        }
+        std::string value = argv[++i];
+
+        if (arg == "--socket") {
+            options.socketPath = value;
+        } else if (arg == "--tree") {
+            options.treePath = value;
+        } else if (arg == "--synthetic") {
+            options.syntheticLeaves = std::stoull(value);
+        } else if (arg == "--threads") {
+            options.threads = std::stoull(value);
+        } else if (arg == "--stats-interval") {
+            options.statsInterval = std::stod(value);
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    if (options.socketPath.empty()) {
+        throw std::invalid_argument("--socket is required");
+    }
+    if (options.treePath.empty() == (options.syntheticLeaves == 0)) {
+        throw std::invalid_argument("Give exactly one of --tree and --synthetic");
+    }
+    return options;
+}
+
+MerkleTree loadTree(const ServerOptions& options) {
+    if (!options.treePath.empty()) {
+        return MerkleTree::openMapped(options.treePath);
+    }
+    std::vector<ByteArray> leaves(options.syntheticLeaves);
+    for (size_t i = 0; i < leaves.size(); i++) {
+        std::string text = "leaf-" + std::to_string(i);
+        leaves[i].assign(text.begin(), text.end());
+    }
+    return MerkleTree(leaves, options.threads);
+}
+
+void printStats(const ServerStats& stats, uint64_t intervalRequests, double intervalSeconds) {
+    std::cout << std::fixed << std::setprecision(0) << "requests " << stats.requests << "  rate "
+              << (intervalSeconds > 0 ? intervalRequests / intervalSeconds : 0) << "/s  batches " << stats.batches
+              << "  p50 " << std::setprecision(1) << stats.p50Ns / 1000.0 << " us  p99 " << stats.p99Ns / 1000.0
+              << " us  max " << stats.maxNs / 1000.0 << " us" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    ServerOptions options;
+    try {
+        options = parseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "merkle_server: " << e.what() << "\n\n";
+        printUsage();
+        return 2;
+    }
+
+    try {
+        MerkleTree tree = loadTree(options);
+        ProofServer server(tree, options.socketPath, options.threads);
+
+        runningServer = &server;
+        std::signal(SIGINT, handleSignal);
+        std::signal(SIGTERM, handleSignal);
+
+        std::cout << "Serving " << tree.getLeafCount() << " leaves on " << options.socketPath << std::endl;
+
+        std::mutex mutex;
+        std::condition_variable stopped;
+        bool done = false;
+        std::thread reporter;
+        if (options.statsInterval > 0) {
+            reporter = std::thread([&] {
+                auto interval = std::chrono::duration<double>(options.statsInterval);
+                ServerStats last;
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stopped.wait_for(lock, interval, [&] { return done; })) {
+                    ServerStats stats = server.getStats();
+                    printStats(stats, stats.requests - last.requests, stats.uptimeSeconds - last.uptimeSeconds);
+                    last = stats;
+                }
+            });
+        }
+
+        server.run();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        stopped.notify_all();
+        if (reporter.joinable()) {
+            reporter.join();
+        }
+        runningServer = nullptr;
+
+        ServerStats stats = server.getStats();
+        printStats(stats, stats.requests, stats.uptimeSeconds);
+    } catch (const std::exception& e) {
+        std::cerr << "merkle_server: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,569 @@
+// sha256_simd.cpp
+#include "sha256_simd.h"
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MERKLE_X86_KERNELS 1
+#endif
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t H0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const size_t BLOCK_SIZE = 64;
+
+// Compresses blockCount consecutive blocks into a single state.
+typedef void (*BlockFunction)(uint32_t state[8], const byte* blocks, size_t blockCount);
+
+// Compresses one block per lane. state holds word i of lane l at state[i * lanes + l].
+typedef void (*LaneFunction)(uint32_t* state, const byte* const* blocks);
+
+inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t load32(const byte* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+void compressScalar(uint32_t state[8], const byte* blocks, size_t blockCount) {
+    for (size_t block = 0; block < blockCount; block++, blocks += BLOCK_SIZE) {
+        uint32_t w[64];
+        for (int t = 0; t < 16; t++) {
+            w[t] = load32(blocks + 4 * t);
+        }
+        for (int t = 16; t < 64; t++) {
+            uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; t++) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[t] + w[t];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef MERKLE_X86_KERNELS
+
+__attribute__((target("sha,sse4.1")))
+void compressShaNi(uint32_t state[8], const byte* blocks, size_t blockCount) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);   // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);        // CDGH
+
+    for (size_t block = 0; block < blockCount; block++, blocks += BLOCK_SIZE) {
+        __m128i savedState0 = state0;
+        __m128i savedState1 = state1;
+        __m128i w[4];
+
+#pragma GCC unroll 16
+        for (int group = 0; group < 16; group++) {
+            __m128i& current = w[group % 4];
+            if (group < 4) {
+                current = _mm_shuffle_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * group)), byteSwap);
+            } else {
+                const __m128i& previous = w[(group + 3) % 4];
+                __m128i schedule = _mm_sha256msg1_epu32(current, w[(group + 1) % 4]);
+                schedule = _mm_add_epi32(schedule, _mm_alignr_epi8(previous, w[(group + 2) % 4], 4));
+                current = _mm_sha256msg2_epu32(schedule, previous);
+            }
+
+            __m128i message = _mm_add_epi32(current, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&K[4 * group])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(message, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, savedState0);
+        state1 = _mm_add_epi32(state1, savedState1);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);              // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);           // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);        // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);           // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+
+// Loads 32 bytes from each of 8 lanes and transposes them so that out[t] holds
+// big-endian message word t of every lane.
+__attribute__((target("avx2"), always_inline))
+inline void loadTransposed8(const byte* const* rows, size_t offset, __m256i out[8]) {
+    const __m256i byteSwap = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+    __m256i r[8];
+    for (int l = 0; l < 8; l++) {
+        r[l] = _mm256_shuffle_epi8(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[l] + offset)), byteSwap);
+    }
+
+    __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+    __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+    __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+    __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+    __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    out[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    out[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    out[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    out[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    out[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    out[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    out[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    out[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+#define ROTR256(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+__attribute__((target("avx2")))
+void compressAvx2(uint32_t* state, const byte* const* blocks) {
+    __m256i w[16];
+    loadTransposed8(blocks, 0, w);
+    loadTransposed8(blocks, 32, w + 8);
+
+    __m256i s[8];
+    for (int i = 0; i < 8; i++) {
+        s[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state + 8 * i));
+    }
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+#pragma GCC unroll 64
+    for (int t = 0; t < 64; t++) {
+        __m256i wt;
+        if (t < 16) {
+            wt = w[t];
+        } else {
+            __m256i w15 = w[(t - 15) & 15];
+            __m256i w2 = w[(t - 2) & 15];
+            __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR256(w15, 7), ROTR256(w15, 18)),
+                                          _mm256_srli_epi32(w15, 3));
+            __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR256(w2, 17), ROTR256(w2, 19)),
+                                          _mm256_srli_epi32(w2, 10));
+            wt = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+            w[t & 15] = wt;
+        }
+
+        __m256i sigma1 = _mm256_xor_si256(_mm256_xor_si256(ROTR256(e, 6), ROTR256(e, 11)), ROTR256(e, 25));
+        __m256i choose = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sigma1),
+                                      _mm256_add_epi32(_mm256_add_epi32(choose, _mm256_set1_epi32(K[t])), wt));
+        __m256i sigma0 = _mm256_xor_si256(_mm256_xor_si256(ROTR256(a, 2), ROTR256(a, 13)), ROTR256(a, 22));
+        __m256i majority = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        __m256i t2 = _mm256_add_epi32(sigma0, majority);
+
+        h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+    }
+
+    __m256i result[8] = {a, b, c, d, e, f, g, h};
+    for (int i = 0; i < 8; i++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(state + 8 * i), _mm256_add_epi32(s[i], result[i]));
+    }
+}
+
+#undef ROTR256
+
+#define XOR3_512(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0x96)
+
+__attribute__((target("avx512f,avx2")))
+void compressAvx512(uint32_t* state, const byte* const* blocks) {
+    __m512i w[16];
+    for (int half = 0; half < 2; half++) {
+        __m256i low[8], high[8];
+        loadTransposed8(blocks, 32 * half, low);
+        loadTransposed8(blocks + 8, 32 * half, high);
+        for (int t = 0; t < 8; t++) {
+            w[8 * half + t] = _mm512_inserti64x4(_mm512_castsi256_si512(low[t]), high[t], 1);
+        }
+    }
+
+    __m512i s[8];
+    for (int i = 0; i < 8; i++) {
+        s[i] = _mm512_loadu_si512(state + 16 * i);
+    }
+    __m512i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+
+#pragma GCC unroll 64
+    for (int t = 0; t < 64; t++) {
+        __m512i wt;
+        if (t < 16) {
+            wt = w[t];
+        } else {
+            __m512i w15 = w[(t - 15) & 15];
+            __m512i w2 = w[(t - 2) & 15];
+            __m512i s0 = XOR3_512(_mm512_ror_epi32(w15, 7), _mm512_ror_epi32(w15, 18), _mm512_srli_epi32(w15, 3));
+            __m512i s1 = XOR3_512(_mm512_ror_epi32(w2, 17), _mm512_ror_epi32(w2, 19), _mm512_srli_epi32(w2, 10));
+            wt = _mm512_add_epi32(_mm512_add_epi32(w[t & 15], s0), _mm512_add_epi32(w[(t - 7) & 15], s1));
+            w[t & 15] = wt;
+        }
+
+        __m512i sigma1 = XOR3_512(_mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11), _mm512_ror_epi32(e, 25));
+        __m512i choose = _mm512_ternarylogic_epi32(e, f, g, 0xCA);
+        __m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, sigma1),
+                                      _mm512_add_epi32(_mm512_add_epi32(choose, _mm512_set1_epi32(K[t])), wt));
+        __m512i sigma0 = XOR3_512(_mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13), _mm512_ror_epi32(a, 22));
+        __m512i majority = _mm512_ternarylogic_epi32(a, b, c, 0xE8);
+        __m512i t2 = _mm512_add_epi32(sigma0, majority);
+
+        h = g; g = f; f = e; e = _mm512_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm512_add_epi32(t1, t2);
+    }
+
+    __m512i result[8] = {a, b, c, d, e, f, g, h};
+    for (int i = 0; i < 8; i++) {
+        _mm512_storeu_si512(state + 16 * i, _mm512_add_epi32(s[i], result[i]));
+    }
+}
+
+#undef XOR3_512
+
+#endif // MERKLE_X86_KERNELS
+
+// A message split into the blocks that can be read in place and a padded tail.
+struct PaddedMessage {
+    const byte* data;
+    size_t fullBlocks;
+    size_t totalBlocks;
+    byte tail[2 * BLOCK_SIZE];
+
+    void assign(const byte* message, size_t size) {
+        data = message;
+        fullBlocks = size / BLOCK_SIZE;
+        size_t remainder = size % BLOCK_SIZE;
+        size_t tailBlocks = remainder + 9 <= BLOCK_SIZE ? 1 : 2;
+        totalBlocks = fullBlocks + tailBlocks;
+
+        std::memset(tail, 0, sizeof(tail));
+        if (remainder > 0) {
+            std::memcpy(tail, message + fullBlocks * BLOCK_SIZE, remainder);
+        }
+        tail[remainder] = 0x80;
+        uint64_t bitLength = uint64_t(size) * 8;
+        byte* lengthField = tail + tailBlocks * BLOCK_SIZE - 8;
+        for (int i = 0; i < 8; i++) {
+            lengthField[i] = byte(bitLength >> (56 - 8 * i));
+        }
+    }
+
+    const byte* block(size_t index) const {
+        return index < fullBlocks ? data + index * BLOCK_SIZE : tail + (index - fullBlocks) * BLOCK_SIZE;
+    }
+};
+
+void writeDigest(const uint32_t* words, size_t stride, Digest& output) {
+    for (int i = 0; i < 8; i++) {
+        uint32_t word = words[i * stride];
+        output[4 * i] = byte(word >> 24);
+        output[4 * i + 1] = byte(word >> 16);
+        output[4 * i + 2] = byte(word >> 8);
+        output[4 * i + 3] = byte(word);
+    }
+}
+
+void hashSingle(BlockFunction compress, const byte* message, size_t size, Digest& output) {
+    uint32_t state[8];
+    std::memcpy(state, H0, sizeof(state));
+    PaddedMessage padded;
+    padded.assign(message, size);
+    if (padded.fullBlocks > 0) {
+        compress(state, message, padded.fullBlocks);
+    }
+    compress(state, padded.tail, padded.totalBlocks - padded.fullBlocks);
+    writeDigest(state, 1, output);
+}
+
+template <size_t Lanes>
+void hashLanes(LaneFunction compress, BlockFunction single,
+               const byte* const* messages, const size_t* sizes, Digest* output, size_t count) {
+    static const byte zeroBlock[BLOCK_SIZE] = {};
+    PaddedMessage lanes[Lanes];
+    alignas(64) uint32_t state[8 * Lanes];
+    const byte* blocks[Lanes];
+
+    size_t start = 0;
+    // A nearly empty group wastes most of the vector; finish it one message at a time.
+    for (; start < count && count - start >= Lanes / 4; start += Lanes) {
+        size_t active = std::min(Lanes, count - start);
+        size_t maxBlocks = 0;
+        for (size_t l = 0; l < active; l++) {
+            lanes[l].assign(messages[start + l], sizes[start + l]);
+            maxBlocks = std::max(maxBlocks, lanes[l].totalBlocks);
+        }
+        for (size_t i = 0; i < 8; i++) {
+            std::fill(state + i * Lanes, state + (i + 1) * Lanes, H0[i]);
+        }
+
+        for (size_t b = 0; b < maxBlocks; b++) {
+            for (size_t l = 0; l < Lanes; l++) {
+                blocks[l] = (l < active && b < lanes[l].totalBlocks) ? lanes[l].block(b) : zeroBlock;
+            }
+            compress(state, blocks);
+            for (size_t l = 0; l < active; l++) {
+                if (lanes[l].totalBlocks == b + 1) {
+                    writeDigest(state + l, Lanes, output[start + l]);
+                }
+            }
+        }
+    }
+
+    for (; start < count; start++) {
+        hashSingle(single, messages[start], sizes[start], output[start]);
+    }
+}
+
+// The padding block shared by every 64-byte message: 0x80, zeros, bit length 512.
+struct Block64Padding {
+    byte block[BLOCK_SIZE] = {};
+    Block64Padding() {
+        block[0] = 0x80;
+        block[BLOCK_SIZE - 2] = 0x02;
+    }
+};
+
+const Block64Padding padding64;
+
+template <size_t Lanes>
+void hashLanes64(LaneFunction compress, BlockFunction single, const byte* input, Digest* output, size_t count) {
+    alignas(64) uint32_t state[8 * Lanes];
+    const byte* blocks[Lanes];
+    const byte* paddingBlocks[Lanes];
+    std::fill(paddingBlocks, paddingBlocks + Lanes, padding64.block);
+
+    size_t start = 0;
+    for (; Lanes > 1 && count - start >= Lanes; start += Lanes) {
+        for (size_t l = 0; l < Lanes; l++) {
+            blocks[l] = input + (start + l) * BLOCK_SIZE;
+        }
+        for (size_t i = 0; i < 8; i++) {
+            std::fill(state + i * Lanes, state + (i + 1) * Lanes, H0[i]);
+        }
+        compress(state, blocks);
+        compress(state, paddingBlocks);
+        for (size_t l = 0; l < Lanes; l++) {
+            writeDigest(state + l, Lanes, output[start + l]);
+        }
+    }
+
+    for (; start < count; start++) {
+        uint32_t singleState[8];
+        std::memcpy(singleState, H0, sizeof(singleState));
+        single(singleState, input + start * BLOCK_SIZE, 1);
+        single(singleState, padding64.block, 1);
+        writeDigest(singleState, 1, output[start]);
+    }
+}
+
+bool cpuSupports(Sha256Backend backend) {
+    switch (backend) {
+    case Sha256Backend::Scalar:
+        return true;
+#ifdef MERKLE_X86_KERNELS
+    case Sha256Backend::ShaNi:
+        return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+    case Sha256Backend::Avx2:
+        return __builtin_cpu_supports("avx2");
+    case Sha256Backend::Avx512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+Sha256Backend detectBackend() {
+    const Sha256Backend preference[] = {
+        Sha256Backend::Avx512, Sha256Backend::ShaNi, Sha256Backend::Avx2, Sha256Backend::Scalar
+    };
+    for (Sha256Backend backend : preference) {
+        if (cpuSupports(backend)) {
+            return backend;
+        }
+    }
+    return Sha256Backend::Scalar;
+}
+
+std::atomic<Sha256Backend>& activeBackend() {
+    static std::atomic<Sha256Backend> backend(detectBackend());
+    return backend;
+}
+
+BlockFunction singleLaneFunction() {
+#ifdef MERKLE_X86_KERNELS
+    static const BlockFunction function =
+        cpuSupports(Sha256Backend::ShaNi) ? compressShaNi : compressScalar;
+    return function;
+#else
+    return compressScalar;
+#endif
+}
+
+} // namespace
+
+Sha256Backend getSha256Backend() {
+    return activeBackend().load(std::memory_order_relaxed);
+}
+
+void setSha256Backend(Sha256Backend backend) {
+    if (!cpuSupports(backend)) {
+        throw std::runtime_error(std::string("SHA-256 backend not supported on this CPU: ") +
+                                 sha256BackendName(backend));
+    }
+    activeBackend().store(backend, std::memory_order_relaxed);
+}
+
+bool isSha256BackendSupported(Sha256Backend backend) {
+    return cpuSupports(backend);
+}
+
+const char* sha256BackendName(Sha256Backend backend) {
+    switch (backend) {
+    case Sha256Backend::Scalar: return "scalar";
+    case Sha256Backend::ShaNi: return "sha-ni";
+    case Sha256Backend::Avx2: return "avx2";
+    case Sha256Backend::Avx512: return "avx512";
+    }
+    return "unknown";
+}
+
+Digest sha256Single(const byte* data, size_t size) {
+    MERKLE_COUNT_HASHES(1, size);
+    Digest output;
+    hashSingle(singleLaneFunction(), data, size, output);
+    return output;
+}
+
+Sha256Stream::Sha256Stream() {
+    std::memcpy(state, H0, sizeof(state));
+}
+
+void Sha256Stream::update(const byte* data, size_t size) {
+    length += size;
+    if (pendingSize > 0) {
+        size_t take = std::min(size, BLOCK_SIZE - pendingSize);
+        std::memcpy(pending + pendingSize, data, take);
+        pendingSize += take;
+        data += take;
+        size -= take;
+        if (pendingSize < BLOCK_SIZE) {
+            return;
+        }
+        singleLaneFunction()(state, pending, 1);
+        pendingSize = 0;
+    }
+
+    size_t blocks = size / BLOCK_SIZE;
+    if (blocks > 0) {
+        singleLaneFunction()(state, data, blocks);
+    }
+    pendingSize = size - blocks * BLOCK_SIZE;
+    std::memcpy(pending, data + blocks * BLOCK_SIZE, pendingSize);
+}
+
+Digest Sha256Stream::finish() {
+    MERKLE_COUNT_HASHES(1, length);
+    // The held-back bytes are the whole unaligned tail of the message, so the
+    // regular padding can be applied to them with the full length patched in.
+    PaddedMessage padded;
+    padded.assign(pending, pendingSize);
+    uint64_t bitLength = length * 8;
+    byte* lengthField = padded.tail + (padded.totalBlocks - padded.fullBlocks) * BLOCK_SIZE - 8;
+    for (int i = 0; i < 8; i++) {
+        lengthField[i] = byte(bitLength >> (56 - 8 * i));
+    }
+    singleLaneFunction()(state, padded.tail, padded.totalBlocks - padded.fullBlocks);
+
+    Digest output;
+    writeDigest(state, 1, output);
+    return output;
+}
+
+void sha256Batch(const byte* const* messages, const size_t* sizes, Digest* output, size_t count) {
+    MERKLE_COUNT_HASHES(count, std::accumulate(sizes, sizes + count, uint64_t(0)));
+    switch (getSha256Backend()) {
+#ifdef MERKLE_X86_KERNELS
+    case Sha256Backend::Avx512:
+        hashLanes<16>(compressAvx512, singleLaneFunction(), messages, sizes, output, count);
+        return;
+    case Sha256Backend::Avx2:
+        hashLanes<8>(compressAvx2, singleLaneFunction(), messages, sizes, output, count);
+        return;
+    case Sha256Backend::ShaNi:
+        for (size_t i = 0; i < count; i++) {
+            hashSingle(compressShaNi, messages[i], sizes[i], output[i]);
+        }
+        return;
+#endif
+    default:
+        for (size_t i = 0; i < count; i++) {
+            hashSingle(compressScalar, messages[i], sizes[i], output[i]);
+        }
+        return;
+    }
+}
+
+void sha256Batch64(const byte* input, Digest* output, size_t count) {
+    MERKLE_COUNT_HASHES(count, 64 * count);
+    switch (getSha256Backend()) {
+#ifdef MERKLE_X86_KERNELS
+    case Sha256Backend::Avx512:
+        hashLanes64<16>(compressAvx512, singleLaneFunction(), input, output, count);
+        return;
+    case Sha256Backend::Avx2:
+        hashLanes64<8>(compressAvx2, singleLaneFunction(), input, output, count);
+        return;
+    case Sha256Backend::ShaNi:
+        hashLanes64<1>(nullptr, compressShaNi, input, output, count);
+        return;
+#endif
+    default:
+        hashLanes64<1>(nullptr, compressScalar, input, output, count);
+        return;
+    }
+}
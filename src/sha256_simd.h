@@ -0,0 +1,56 @@
+// sha256_simd.h
+#ifndef SHA256_SIMD_H
+#define SHA256_SIMD_H
+
+#include "hash.h"
+
+// Multi-buffer SHA-256: hashes many independent messages at once, one message
+// per SIMD lane. The backend is picked from the CPU at first use.
+enum class Sha256Backend {
+    Scalar,  // portable C++, one message at a time
+    ShaNi,   // x86 SHA extensions, one message at a time
+    Avx2,    // 8 messages in parallel
+    Avx512   // 16 messages in parallel
+};
+
+Sha256Backend getSha256Backend();
+
+// Overrides the runtime choice, e.g. to compare backends in a benchmark.
+// Throws std::runtime_error if the CPU does not support the backend.
+void setSha256Backend(Sha256Backend backend);
+
+bool isSha256BackendSupported(Sha256Backend backend);
+
+const char* sha256BackendName(Sha256Backend backend);
+
+// Hashes one message with the fastest single-stream kernel (SHA-NI or scalar).
+// Unlike OpenSSL 3's one-shot SHA256(), this never allocates.
+Digest sha256Single(const byte* data, size_t size);
+
+// Incremental SHA-256 with the single-stream kernel, for messages that arrive
+// in pieces. Whole blocks are compressed straight from the caller's buffer;
+// only a partial block is held back between updates.
+class Sha256Stream {
+public:
+    Sha256Stream();
+
+    void update(const byte* data, size_t size);
+
+    // The digest of everything passed to update(). The stream is spent after.
+    Digest finish();
+
+private:
+    uint32_t state[8];
+    byte pending[64];
+    size_t pendingSize = 0;
+    uint64_t length = 0;
+};
+
+// Hashes count messages of exactly 64 bytes each, stored back to back in
+// input. This is the shape of an internal node: two concatenated child digests.
+void sha256Batch64(const byte* input, Digest* output, size_t count);
+
+// Hashes count messages of arbitrary length.
+void sha256Batch(const byte* const* messages, const size_t* sizes, Digest* output, size_t count);
+
+#endif // SHA256_SIMD_H
@@ -0,0 +1,455 @@
+// sparse_merkle_tree.cpp
+#include "sparse_merkle_tree.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Bit of key at depth (0 = the bit that chooses the root's child).
+bool keyBit(const Digest& key, size_t depth) {
+    return (key[depth / 8] >> (7 - depth % 8)) & 1;
+}
+
+Digest flipBit(Digest key, size_t depth) {
+    key[depth / 8] ^= byte(0x80 >> (depth % 8));
+    return key;
+}
+
+// Depth of the first bit where a and b differ, or SPARSE_TREE_DEPTH if equal.
+size_t firstDifference(const Digest& a, const Digest& b) {
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i] != b[i]) {
+            return 8 * i + std::countl_zero(uint8_t(a[i] ^ b[i]));
+        }
+    }
+    return SPARSE_TREE_DEPTH;
+}
+
+// Key bits above a node at height, the rest cleared.
+Digest prefixOf(Digest key, size_t height) {
+    size_t keptBits = SPARSE_TREE_DEPTH - height;
+    size_t keptBytes = keptBits / 8;
+    if (keptBits % 8 != 0) {
+        key[keptBytes] &= byte(0xFF << (8 - keptBits % 8));
+        keptBytes++;
+    }
+    std::fill(key.begin() + keptBytes, key.end(), 0);
+    return key;
+}
+
+const size_t MIN_CAPACITY = 16;
+
+// Slots for count nodes at no more than 3/4 load.
+size_t capacityFor(size_t count) {
+    return std::max(MIN_CAPACITY, std::bit_ceil(count + count / 3 + 1));
+}
+
+} // namespace
+
+template <typename HashPolicy>
+const Digest& BasicSparseMerkleTree<HashPolicy>::defaultDigest(size_t height) {
+    static const std::array<Digest, SPARSE_TREE_DEPTH + 1> defaults = [] {
+        std::array<Digest, SPARSE_TREE_DEPTH + 1> digests;
+        digests[0] = Digest{};
+        for (size_t h = 0; h < SPARSE_TREE_DEPTH; h++) {
+            digests[h + 1] = HashPolicy::combine(digests[h], digests[h]);
+        }
+        return digests;
+    }();
+    return defaults[height];
+}
+
+template <typename HashPolicy>
+size_t BasicSparseMerkleTree<HashPolicy>::getMemoryUsage() const {
+    return slots.capacity() * sizeof(Slot) + records.capacity() * sizeof(LeafRecord) +
+           freeRecords.capacity() * sizeof(uint32_t);
+}
+
+template <typename HashPolicy>
+size_t BasicSparseMerkleTree<HashPolicy>::bucketOf(const Digest& key, size_t height) const {
+    uint64_t words[4];
+    std::memcpy(words, prefixOf(key, height).data(), sizeof(words));
+    uint64_t hash = height * 0x9E3779B97F4A7C15ULL;
+    for (uint64_t word : words) {
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    return hash & (slots.size() - 1);
+}
+
+template <typename HashPolicy>
+size_t BasicSparseMerkleTree<HashPolicy>::probe(const Digest& key, size_t height) const {
+    size_t mask = slots.size() - 1;
+    size_t slot = bucketOf(key, height);
+    while (slots[slot].height != EMPTY &&
+           (slots[slot].height != height ||
+            firstDifference(records[slots[slot].record].key, key) < SPARSE_TREE_DEPTH - height)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+template <typename HashPolicy>
+const typename BasicSparseMerkleTree<HashPolicy>::Slot*
+BasicSparseMerkleTree<HashPolicy>::findNode(const Digest& key, size_t height) const {
+    if (slots.empty()) {
+        return nullptr;
+    }
+    const Slot& slot = slots[probe(key, height)];
+    return slot.height == EMPTY ? nullptr : &slot;
+}
+
+template <typename HashPolicy>
+typename BasicSparseMerkleTree<HashPolicy>::Slot&
+BasicSparseMerkleTree<HashPolicy>::storeNode(const Digest& key, size_t height, uint32_t record) {
+    if (slots.empty() || 4 * (usedSlots + 1) > 3 * slots.size()) {
+        rehash(capacityFor(usedSlots + 1));
+    }
+    Slot& slot = slots[probe(key, height)];
+    if (slot.height == EMPTY) {
+        slot = Slot{defaultDigest(height), record, uint16_t(height), 0};
+        usedSlots++;
+    }
+    slot.record = record;
+    return slot;
+}
+
+template <typename HashPolicy>
+void BasicSparseMerkleTree<HashPolicy>::eraseNode(const Digest& key, size_t height) {
+    size_t hole = probe(key, height);
+    if (slots[hole].height == EMPTY) {
+        return;
+    }
+
+    // Backward-shift deletion, as in LeafIndex: later entries of the run move
+    // into the hole when it lies between their bucket and their slot.
+    size_t mask = slots.size() - 1;
+    for (size_t next = (hole + 1) & mask; slots[next].height != EMPTY; next = (next + 1) & mask) {
+        size_t home = bucketOf(records[slots[next].record].key, slots[next].height);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+    }
+    slots[hole].height = EMPTY;
+    usedSlots--;
+}
+
+template <typename HashPolicy>
+void BasicSparseMerkleTree<HashPolicy>::rehash(size_t capacity) {
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.assign(capacity, Slot{Digest{}, 0, EMPTY, 0});
+    size_t mask = capacity - 1;
+    for (const Slot& entry : old) {
+        if (entry.height == EMPTY) {
+            continue;
+        }
+        size_t slot = bucketOf(records[entry.record].key, entry.height);
+        while (slots[slot].height != EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = entry;
+    }
+}
+
+template <typename HashPolicy>
+uint32_t BasicSparseMerkleTree<HashPolicy>::addRecord(const Digest& key, const Digest& leafHash) {
+    if (!freeRecords.empty()) {
+        uint32_t record = freeRecords.back();
+        freeRecords.pop_back();
+        records[record] = LeafRecord{key, leafHash};
+        return record;
+    }
+    if (records.size() >= UINT32_MAX) {
+        throw std::length_error("Sparse Merkle tree holds at most 2^32 - 1 keys.");
+    }
+    records.push_back(LeafRecord{key, leafHash});
+    return uint32_t(records.size() - 1);
+}
+
+template <typename HashPolicy>
+Digest BasicSparseMerkleTree<HashPolicy>::digestAt(const Digest& key, size_t height) const {
+    const Slot* node = findNode(key, height);
+    return node ? node->hash : defaultDigest(height);
+}
+
+template <typename HashPolicy>
+Digest BasicSparseMerkleTree<HashPolicy>::combineOnPath(const Digest& key, size_t height,
+                                                        const Digest& child, const Digest& sibling) {
+    // The node at height is a right child when the bit choosing it is set.
+    return keyBit(key, SPARSE_TREE_DEPTH - 1 - height) ? HashPolicy::combine(sibling, child)
+                                                       : HashPolicy::combine(child, sibling);
+}
+
+template <typename HashPolicy>
+Digest BasicSparseMerkleTree<HashPolicy>::foldLeaf(const Digest& key, const Digest& leafHash, size_t height) {
+    Digest hash = leafHash;
+    for (size_t h = 0; h < height; h++) {
+        hash = combineOnPath(key, h, hash, defaultDigest(h));
+    }
+    return hash;
+}
+
+template <typename HashPolicy>
+void BasicSparseMerkleTree<HashPolicy>::rehashPath(const Digest& key, size_t height, Digest hash, uint32_t record) {
+    for (size_t h = height; h < SPARSE_TREE_DEPTH; h++) {
+        Digest sibling = digestAt(flipBit(key, SPARSE_TREE_DEPTH - 1 - h), h);
+        hash = combineOnPath(key, h, hash, sibling);
+        storeNode(key, h + 1, record).hash = hash;
+    }
+}
+
+template <typename HashPolicy>
+Digest BasicSparseMerkleTree<HashPolicy>::getRootHash() const {
+    return digestAt(Digest{}, SPARSE_TREE_DEPTH);
+}
+
+template <typename HashPolicy>
+void BasicSparseMerkleTree<HashPolicy>::insert(const Digest& key, std::span<const byte> value) {
+    Digest leafHash = HashPolicy::leaf(value.data(), value.size());
+
+    size_t height = SPARSE_TREE_DEPTH;
+    const Slot* node = findNode(key, height);
+    while (node != nullptr && !node->isLeaf) {
+        height--;
+        node = findNode(key, height);
+    }
+
+    if (node == nullptr) {
+        uint32_t record = addRecord(key, leafHash);
+        Digest hash = foldLeaf(key, leafHash, height);
+        Slot& slot = storeNode(key, height, record);
+        slot.hash = hash;
+        slot.isLeaf = 1;
+        keyCount++;
+        rehashPath(key, height, hash, record);
+        return;
+    }
+
+    uint32_t otherRecord = node->record;
+    if (records[otherRecord].key == key) {
+        records[otherRecord].leafHash = leafHash;
+        Digest hash = foldLeaf(key, leafHash, height);
+        storeNode(key, height, otherRecord).hash = hash;
+        rehashPath(key, height, hash, otherRecord);
+        return;
+    }
+
+    // Another key holds this subtree alone. Both keys move down to the node
+    // where their paths part; the nodes in between have one empty child.
+    LeafRecord other = records[otherRecord];
+    eraseNode(key, height);
+    uint32_t record = addRecord(key, leafHash);
+    size_t splitHeight = SPARSE_TREE_DEPTH - firstDifference(key, other.key);
+
+    Digest otherHash = foldLeaf(other.key, other.leafHash, splitHeight - 1);
+    Digest ownHash = foldLeaf(key, leafHash, splitHeight - 1);
+    Slot& otherSlot = storeNode(other.key, splitHeight - 1, otherRecord);
+    otherSlot.hash = otherHash;
+    otherSlot.isLeaf = 1;
+    Slot& ownSlot = storeNode(key, splitHeight - 1, record);
+    ownSlot.hash = ownHash;
+    ownSlot.isLeaf = 1;
+    keyCount++;
+
+    Digest hash = combineOnPath(key, splitHeight - 1, ownHash, otherHash);
+    storeNode(key, splitHeight, record).hash = hash;
+    for (size_t h = splitHeight; h < height; h++) {
+        hash = combineOnPath(key, h, hash, defaultDigest(h));
+        storeNode(key, h + 1, record).hash = hash;
+    }
+    rehashPath(key, height, hash, record);
+}
+
+template <typename HashPolicy>
+bool BasicSparseMerkleTree<HashPolicy>::erase(const Digest& key) {
+    size_t height = SPARSE_TREE_DEPTH;
+    const Slot* node = findNode(key, height);
+    while (node != nullptr && !node->isLeaf) {
+        height--;
+        node = findNode(key, height);
+    }
+    if (node == nullptr || records[node->record].key != key) {
+        return false;
+    }
+    // The record stays readable until the end: ancestors still name it, and
+    // each is pointed at another key as it is rewritten.
+    uint32_t removed = node->record;
+    eraseNode(key, height);
+    keyCount--;
+
+    // Every ancestor had at least two keys. Where one is left with a single
+    // key, that key's entry moves up to take the ancestor's place.
+    for (size_t h = height; h < SPARSE_TREE_DEPTH; h++) {
+        Digest siblingKey = flipBit(key, SPARSE_TREE_DEPTH - 1 - h);
+        const Slot* child = findNode(key, h);
+        const Slot* sibling = findNode(siblingKey, h);
+
+        const Slot* lone = nullptr;
+        if (child == nullptr && sibling->isLeaf) {
+            lone = sibling;
+        } else if (sibling == nullptr && child->isLeaf) {
+            lone = child;
+        }
+
+        if (lone == nullptr) {
+            Digest childHash = child == nullptr ? defaultDigest(h) : child->hash;
+            Digest siblingHash = sibling == nullptr ? defaultDigest(h) : sibling->hash;
+            uint32_t record = (sibling != nullptr ? sibling : child)->record;
+            Digest hash = combineOnPath(key, h, childHash, siblingHash);
+            storeNode(key, h + 1, record).hash = hash;
+            rehashPath(key, h + 1, hash, record);
+            freeRecords.push_back(removed);
+            return true;
+        }
+
+        Slot leaf = *lone;
+        eraseNode(lone == child ? key : siblingKey, h);
+        Slot& moved = storeNode(key, h + 1, leaf.record);
+        moved.hash = combineOnPath(records[leaf.record].key, h, leaf.hash, defaultDigest(h));
+        moved.isLeaf = 1;
+    }
+    freeRecords.push_back(removed);
+    return true;
+}
+
+template <typename HashPolicy>
+bool BasicSparseMerkleTree<HashPolicy>::contains(const Digest& key) const {
+    for (size_t height = SPARSE_TREE_DEPTH; ; height--) {
+        const Slot* node = findNode(key, height);
+        if (node == nullptr) {
+            return false;
+        }
+        if (node->isLeaf) {
+            return records[node->record].key == key;
+        }
+    }
+}
+
+template <typename HashPolicy>
+SparseMerkleProof BasicSparseMerkleTree<HashPolicy>::generateProof(const Digest& key) const {
+    SparseMerkleProof proof;
+    proof.siblings.resize(SPARSE_TREE_DEPTH);
+
+    size_t height = SPARSE_TREE_DEPTH;
+    const Slot* node = findNode(key, height);
+    while (node != nullptr && !node->isLeaf) {
+        height--;
+        proof.siblings[height] = digestAt(flipBit(key, SPARSE_TREE_DEPTH - 1 - height), height);
+        node = findNode(key, height);
+    }
+
+    // Below an empty node or a lone leaf every sibling is empty, except the
+    // one holding a different lone key where its path leaves ours.
+    for (size_t h = 0; h < height; h++) {
+        proof.siblings[h] = defaultDigest(h);
+    }
+    if (node != nullptr && records[node->record].key != key) {
+        const LeafRecord& other = records[node->record];
+        size_t splitHeight = SPARSE_TREE_DEPTH - firstDifference(key, other.key);
+        proof.siblings[splitHeight - 1] = foldLeaf(other.key, other.leafHash, splitHeight - 1);
+    }
+    return proof;
+}
+
+template <typename HashPolicy>
+CompressedSparseProof BasicSparseMerkleTree<HashPolicy>::generateCompressedProof(const Digest& key) const {
+    return compressProof(generateProof(key));
+}
+
+template <typename HashPolicy>
+CompressedSparseProof BasicSparseMerkleTree<HashPolicy>::compressProof(const SparseMerkleProof& proof) {
+    if (proof.siblings.size() != SPARSE_TREE_DEPTH) {
+        throw std::invalid_argument("A sparse proof needs one sibling per level.");
+    }
+
+    CompressedSparseProof compressed;
+    for (size_t h = 0; h < SPARSE_TREE_DEPTH; h++) {
+        if (proof.siblings[h] != defaultDigest(h)) {
+            compressed.nonDefault[h / 64] |= uint64_t(1) << (h % 64);
+            compressed.siblings.push_back(proof.siblings[h]);
+        }
+    }
+    return compressed;
+}
+
+template <typename HashPolicy>
+SparseMerkleProof BasicSparseMerkleTree<HashPolicy>::expandProof(const CompressedSparseProof& proof) {
+    size_t present = 0;
+    for (uint64_t word : proof.nonDefault) {
+        present += std::popcount(word);
+    }
+    if (present != proof.siblings.size()) {
+        throw std::invalid_argument("Compressed sparse proof does not match its bitmap.");
+    }
+
+    SparseMerkleProof expanded;
+    expanded.siblings.resize(SPARSE_TREE_DEPTH);
+    size_t next = 0;
+    for (size_t h = 0; h < SPARSE_TREE_DEPTH; h++) {
+        bool isPresent = (proof.nonDefault[h / 64] >> (h % 64)) & 1;
+        expanded.siblings[h] = isPresent ? proof.siblings[next++] : defaultDigest(h);
+    }
+    return expanded;
+}
+
+template <typename HashPolicy>
+bool BasicSparseMerkleTree<HashPolicy>::verifyPath(const Digest& rootHash, const Digest& key, Digest current,
+                                                   const SparseMerkleProof& proof) {
+    if (proof.siblings.size() != SPARSE_TREE_DEPTH) {
+        return false;
+    }
+    for (size_t h = 0; h < SPARSE_TREE_DEPTH; h++) {
+        current = combineOnPath(key, h, current, proof.siblings[h]);
+    }
+    return current == rootHash;
+}
+
+template <typename HashPolicy>
+bool BasicSparseMerkleTree<HashPolicy>::verifyPath(const Digest& rootHash, const Digest& key, Digest current,
+                                                   const CompressedSparseProof& proof) {
+    size_t next = 0;
+    for (size_t h = 0; h < SPARSE_TREE_DEPTH; h++) {
+        if ((proof.nonDefault[h / 64] >> (h % 64)) & 1) {
+            if (next == proof.siblings.size()) {
+                return false;
+            }
+            current = combineOnPath(key, h, current, proof.siblings[next++]);
+        } else {
+            current = combineOnPath(key, h, current, defaultDigest(h));
+        }
+    }
+    return next == proof.siblings.size() && current == rootHash;
+}
+
+template <typename HashPolicy>
+bool BasicSparseMerkleTree<HashPolicy>::verifyMembership(const Digest& rootHash, const Digest& key,
+                                                         std::span<const byte> value,
+                                                         const SparseMerkleProof& proof) {
+    return verifyPath(rootHash, key, HashPolicy::leaf(value.data(), value.size()), proof);
+}
+
+template <typename HashPolicy>
+bool BasicSparseMerkleTree<HashPolicy>::verifyNonMembership(const Digest& rootHash, const Digest& key,
+                                                            const SparseMerkleProof& proof) {
+    return verifyPath(rootHash, key, defaultDigest(0), proof);
+}
+
+template <typename HashPolicy>
+bool BasicSparseMerkleTree<HashPolicy>::verifyMembership(const Digest& rootHash, const Digest& key,
+                                                         std::span<const byte> value,
+                                                         const CompressedSparseProof& proof) {
+    return verifyPath(rootHash, key, HashPolicy::leaf(value.data(), value.size()), proof);
+}
+
+template <typename HashPolicy>
+bool BasicSparseMerkleTree<HashPolicy>::verifyNonMembership(const Digest& rootHash, const Digest& key,
+                                                            const CompressedSparseProof& proof) {
+    return verifyPath(rootHash, key, defaultDigest(0), proof);
+}
+
+template class BasicSparseMerkleTree<Sha256Policy>;
+template class BasicSparseMerkleTree<Blake3Policy>;
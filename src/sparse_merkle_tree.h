@@ -0,0 +1,161 @@
+// sparse_merkle_tree.h
+#ifndef SPARSE_MERKLE_TREE_H
+#define SPARSE_MERKLE_TREE_H
+
+#include "hash.h"
+#include "hash_policy.h"
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Sibling digests on the path of one key, siblings[h] being the sibling at
+// height h (0 = leaves). A full proof always holds SPARSE_TREE_DEPTH entries.
+struct SparseMerkleProof {
+    std::vector<Digest> siblings;
+};
+
+// The same proof without the siblings that equal the default digest of their
+// height. Bit h of nonDefault is set when the height-h sibling is present;
+// present siblings are stored bottom-up. A proof for one of n random keys
+// carries about log2(n) digests instead of 256.
+struct CompressedSparseProof {
+    std::array<uint64_t, 4> nonDefault = {};
+    std::vector<Digest> siblings;
+};
+
+const size_t SPARSE_TREE_DEPTH = 256;
+
+// A Merkle tree with one leaf slot for every 256-bit key, where the bits of the
+// key, most significant first, choose the path from the root. An empty slot
+// holds the all-zero digest and an occupied one HashPolicy::leaf(value), so an
+// empty subtree of height h always has the digest defaultDigest(h) and is never
+// stored.
+//
+// The node store is a hash table from (height, key prefix) to digest. It holds
+// the nodes with at least two keys below them, plus one entry per key at the
+// top of the subtree it occupies alone, so n keys take O(n) entries instead of
+// n * 256. Insert, update and erase cost O(depth) hashes.
+//
+// Keys and leaf digests live once each in a record array. A table slot stores
+// no key prefix: it names the record of some key below its node, whose leading
+// bits are the prefix, and is 40 bytes with the node's digest.
+template <typename HashPolicy = Sha256Policy>
+class BasicSparseMerkleTree {
+    static_assert(HashPolicy::digestSize == sizeof(Digest), "node storage holds fixed 32-byte digests");
+
+public:
+    BasicSparseMerkleTree() = default;
+
+    // Root of the empty tree when nothing has been inserted.
+    Digest getRootHash() const;
+
+    // Sets the value of key, inserting it if it is absent.
+    void insert(const Digest& key, std::span<const byte> value);
+
+    // Removes key. Returns false if it was absent.
+    bool erase(const Digest& key);
+
+    bool contains(const Digest& key) const;
+
+    size_t size() const { return keyCount; }
+
+    // Bytes held by the node table and the key records.
+    size_t getMemoryUsage() const;
+
+    // Proves either that key holds some value or that its slot is empty; the
+    // verifier decides which by the function it calls.
+    SparseMerkleProof generateProof(const Digest& key) const;
+
+    CompressedSparseProof generateCompressedProof(const Digest& key) const;
+
+    static CompressedSparseProof compressProof(const SparseMerkleProof& proof);
+
+    // Throws std::invalid_argument if the proof is malformed.
+    static SparseMerkleProof expandProof(const CompressedSparseProof& proof);
+
+    static bool verifyMembership(const Digest& rootHash, const Digest& key,
+                                 std::span<const byte> value, const SparseMerkleProof& proof);
+
+    static bool verifyNonMembership(const Digest& rootHash, const Digest& key,
+                                    const SparseMerkleProof& proof);
+
+    // The compressed forms verify without expanding the proof.
+    static bool verifyMembership(const Digest& rootHash, const Digest& key,
+                                 std::span<const byte> value, const CompressedSparseProof& proof);
+
+    static bool verifyNonMembership(const Digest& rootHash, const Digest& key,
+                                    const CompressedSparseProof& proof);
+
+    // Digest of an empty subtree of the given height, computed once.
+    static const Digest& defaultDigest(size_t height);
+
+private:
+    // One stored node: a node with at least two keys below it, or a key alone
+    // in its subtree, stored once at the top of that subtree. record is a key
+    // below the node; for a lone key, its own.
+    struct Slot {
+        Digest hash;
+        uint32_t record;
+        uint16_t height;  // EMPTY for a free slot
+        uint16_t isLeaf;
+    };
+
+    struct LeafRecord {
+        Digest key;
+        Digest leafHash;
+    };
+
+    static constexpr uint16_t EMPTY = UINT16_MAX;
+
+    // Open-addressed with linear probing, at most 3/4 full.
+    std::vector<Slot> slots;
+    size_t usedSlots = 0;
+
+    std::vector<LeafRecord> records;
+    std::vector<uint32_t> freeRecords;
+    size_t keyCount = 0;
+
+    size_t bucketOf(const Digest& key, size_t height) const;
+
+    // The slot of the node at height on key's path, or the empty slot that
+    // ends its probe sequence.
+    size_t probe(const Digest& key, size_t height) const;
+
+    const Slot* findNode(const Digest& key, size_t height) const;
+
+    // Finds or adds the node at height on key's path and points it at record,
+    // which must hold a key below that node. The reference lasts until the
+    // table next changes.
+    Slot& storeNode(const Digest& key, size_t height, uint32_t record);
+
+    void eraseNode(const Digest& key, size_t height);
+
+    void rehash(size_t capacity);
+
+    uint32_t addRecord(const Digest& key, const Digest& leafHash);
+
+    Digest digestAt(const Digest& key, size_t height) const;
+
+    // Digest at the given height of a subtree holding only this leaf.
+    static Digest foldLeaf(const Digest& key, const Digest& leafHash, size_t height);
+
+    // Recomputes the nodes on key's path from height + 1 up to the root, given
+    // the new digest of the path node at height, and points them at record.
+    void rehashPath(const Digest& key, size_t height, Digest hash, uint32_t record);
+
+    static Digest combineOnPath(const Digest& key, size_t height, const Digest& child, const Digest& sibling);
+
+    static bool verifyPath(const Digest& rootHash, const Digest& key, Digest current,
+                           const SparseMerkleProof& proof);
+
+    static bool verifyPath(const Digest& rootHash, const Digest& key, Digest current,
+                           const CompressedSparseProof& proof);
+};
+
+typedef BasicSparseMerkleTree<Sha256Policy> SparseMerkleTree;
+
+extern template class BasicSparseMerkleTree<Sha256Policy>;
+extern template class BasicSparseMerkleTree<Blake3Policy>;
+
+#endif // SPARSE_MERKLE_TREE_H
@@ -0,0 +1,228 @@
+// stats.cpp
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+
+namespace {
+
+struct PhaseCounters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> totalNs{0};
+    std::atomic<uint64_t> allocations{0};
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> latency{};
+};
+
+struct Counters {
+    std::atomic<uint64_t> hashCalls{0};
+    std::atomic<uint64_t> hashedBytes{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> allocatedBytes{0};
+    std::array<PhaseCounters, PHASE_COUNT> phases;
+};
+
+// Constant-initialised, so operator new may use it before main().
+constinit Counters counters;
+
+// Allocations made by this thread, for attributing them to phases.
+thread_local uint64_t threadAllocations = 0;
+
+size_t latencyBucket(uint64_t ns) {
+    return std::min<size_t>(std::bit_width(ns), LATENCY_BUCKETS - 1);
+}
+
+} // namespace
+
+#ifdef MERKLE_STATS
+
+namespace {
+
+// alignment is 0 for the plain forms, which malloc serves.
+void* countedAllocate(std::size_t size, std::size_t alignment) {
+    threadAllocations++;
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+
+    if (size == 0) {
+        size = 1;
+    }
+    while (true) {
+        void* pointer = nullptr;
+        if (alignment == 0) {
+            pointer = std::malloc(size);
+        } else if (::posix_memalign(&pointer, std::max(alignment, sizeof(void*)), size) != 0) {
+            pointer = nullptr;
+        }
+        if (pointer != nullptr) {
+            return pointer;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+} // namespace
+
+// Counting replacement of the global allocator, as allowed by the standard.
+// The nothrow forms forward to these in libstdc++. Over-aligned types
+// (alignas above 16, e.g. cache-line padded slots) take the std::align_val_t
+// forms.
+void* operator new(std::size_t size) {
+    return countedAllocate(size, 0);
+}
+
+void* operator new[](std::size_t size) {
+    return countedAllocate(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return countedAllocate(size, std::size_t(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return countedAllocate(size, std::size_t(alignment));
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+#endif // MERKLE_STATS
+
+uint64_t PhaseStats::latencyQuantileNs(double q) const {
+    uint64_t target = uint64_t(q * calls + 0.5);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += latency[b];
+        if (seen >= target && seen > 0) {
+            return uint64_t(1) << b;
+        }
+    }
+    return 0;
+}
+
+const char* phaseName(Phase phase) {
+    switch (phase) {
+    case Phase::LeafHashing:
+        return "leaf_hashing";
+    case Phase::LevelBuilding:
+        return "level_building";
+    case Phase::ProofGeneration:
+        return "proof_generation";
+    case Phase::Verification:
+        return "verification";
+    }
+    return "unknown";
+}
+
+MerkleStats getStats() {
+    MerkleStats stats;
+    stats.enabled = statsEnabled();
+    stats.hashCalls = counters.hashCalls.load(std::memory_order_relaxed);
+    stats.hashedBytes = counters.hashedBytes.load(std::memory_order_relaxed);
+    stats.allocations = counters.allocations.load(std::memory_order_relaxed);
+    stats.allocatedBytes = counters.allocatedBytes.load(std::memory_order_relaxed);
+    for (size_t p = 0; p < PHASE_COUNT; p++) {
+        const PhaseCounters& source = counters.phases[p];
+        PhaseStats& phase = stats.phases[p];
+        phase.calls = source.calls.load(std::memory_order_relaxed);
+        phase.totalNs = source.totalNs.load(std::memory_order_relaxed);
+        phase.allocations = source.allocations.load(std::memory_order_relaxed);
+        for (size_t b = 0; b < LATENCY_BUCKETS; b++) {
+            phase.latency[b] = source.latency[b].load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+void resetStats() {
+    counters.hashCalls = 0;
+    counters.hashedBytes = 0;
+    counters.allocations = 0;
+    counters.allocatedBytes = 0;
+    for (PhaseCounters& phase : counters.phases) {
+        phase.calls = 0;
+        phase.totalNs = 0;
+        phase.allocations = 0;
+        for (auto& bucket : phase.latency) {
+            bucket = 0;
+        }
+    }
+}
+
+void writeStatsJson(std::ostream& out, const MerkleStats& stats) {
+    out << "{\"enabled\": " << (stats.enabled ? "true" : "false")
+        << ", \"hash_calls\": " << stats.hashCalls << ", \"hashed_bytes\": " << stats.hashedBytes
+        << ", \"allocations\": " << stats.allocations << ", \"allocated_bytes\": " << stats.allocatedBytes
+        << ", \"phases\": {";
+    for (size_t p = 0; p < PHASE_COUNT; p++) {
+        const PhaseStats& phase = stats.phases[p];
+        out << (p > 0 ? ", " : "") << "\"" << phaseName(Phase(p)) << "\": {\"calls\": " << phase.calls
+            << ", \"total_ns\": " << phase.totalNs
+            << ", \"avg_ns\": " << (phase.calls ? phase.totalNs / phase.calls : 0)
+            << ", \"p50_ns\": " << phase.latencyQuantileNs(0.5)
+            << ", \"p99_ns\": " << phase.latencyQuantileNs(0.99)
+            << ", \"allocations\": " << phase.allocations << ", \"latency_ns\": {";
+        // Keyed by bucket upper bound, skipping empty buckets.
+        bool first = true;
+        for (size_t b = 0; b < LATENCY_BUCKETS; b++) {
+            if (phase.latency[b] != 0) {
+                out << (first ? "" : ", ") << "\"" << (uint64_t(1) << b) << "\": " << phase.latency[b];
+                first = false;
+            }
+        }
+        out << "}}";
+    }
+    out << "}}\n";
+}
+
+void recordHashes(uint64_t calls, uint64_t bytes) {
+    counters.hashCalls.fetch_add(calls, std::memory_order_relaxed);
+    counters.hashedBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+PhaseTimer::PhaseTimer(Phase phase)
+    : phase(phase), start(std::chrono::steady_clock::now()), startAllocations(threadAllocations) {}
+
+PhaseTimer::~PhaseTimer() {
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    PhaseCounters& counter = counters.phases[size_t(phase)];
+    counter.calls.fetch_add(1, std::memory_order_relaxed);
+    counter.totalNs.fetch_add(ns, std::memory_order_relaxed);
+    counter.allocations.fetch_add(threadAllocations - startAllocations, std::memory_order_relaxed);
+    counter.latency[latencyBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,96 @@
+// stats.h
+#ifndef STATS_H
+#define STATS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Built-in instrumentation, compiled in with the MERKLE_STATS CMake option.
+// Without it the recording macros below expand to nothing and getStats()
+// returns zeros, so a normal build pays no cost at all.
+//
+// With it every hash call is counted where it enters a kernel, the tree times
+// its phases with scoped timers and the global operator new counts
+// allocations. Counters are process-wide and updated with relaxed atomics.
+
+enum class Phase {
+    LeafHashing,      // hashing leaf data into level 0
+    LevelBuilding,    // hashing internal nodes, in builds and updates
+    ProofGeneration,
+    Verification,
+};
+
+const size_t PHASE_COUNT = 4;
+
+// Bucket b counts durations d with 2^(b-1) <= d < 2^b nanoseconds (bucket 0
+// holds d = 0).
+const size_t LATENCY_BUCKETS = 48;
+
+struct PhaseStats {
+    uint64_t calls = 0;
+    uint64_t totalNs = 0;
+    uint64_t allocations = 0;  // allocations made inside the phase
+    std::array<uint64_t, LATENCY_BUCKETS> latency = {};
+
+    // Upper bound of the bucket holding quantile q (0 < q <= 1) of the calls.
+    uint64_t latencyQuantileNs(double q) const;
+};
+
+struct MerkleStats {
+    bool enabled = false;
+    uint64_t hashCalls = 0;
+    uint64_t hashedBytes = 0;
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+    std::array<PhaseStats, PHASE_COUNT> phases;
+};
+
+constexpr bool statsEnabled() {
+#ifdef MERKLE_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* phaseName(Phase phase);
+
+// A consistent-enough snapshot: each counter is read atomically, but counters
+// moving during the call may be from slightly different moments.
+MerkleStats getStats();
+
+void resetStats();
+
+// One JSON object with the counters, and per phase the call count, total and
+// average time, p50/p99 and the non-empty latency buckets.
+void writeStatsJson(std::ostream& out, const MerkleStats& stats);
+
+void recordHashes(uint64_t calls, uint64_t bytes);
+
+// Times the enclosing scope and attributes the current thread's allocations
+// during it to the phase.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+    uint64_t startAllocations;
+};
+
+#ifdef MERKLE_STATS
+#define MERKLE_COUNT_HASHES(calls, bytes) recordHashes((calls), (bytes))
+#define MERKLE_PHASE(phase) PhaseTimer merklePhaseTimer(phase)
+#else
+#define MERKLE_COUNT_HASHES(calls, bytes) ((void)0)
+#define MERKLE_PHASE(phase) ((void)0)
+#endif
+
+#endif // STATS_H
@@ -0,0 +1,146 @@
+// thread_pool.cpp
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace {
+
+// Which pool the current thread works for and which deque it owns. Threads
+// outside the pool share deque 0.
+thread_local const ThreadPool* workerPool = nullptr;
+thread_local size_t workerIndex = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threadCount) : queuedTasks(0), stopping(false) {
+    if (threadCount == 0) {
+        threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    for (size_t i = 0; i < threadCount; i++) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 1; i < threadCount; i++) {
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::currentQueue() const {
+    return workerPool == this ? workerIndex : 0;
+}
+
+void ThreadPool::push(Task task) {
+    Queue& queue = *queues[currentQueue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queuedTasks++;
+    }
+    wakeUp.notify_one();
+}
+
+bool ThreadPool::runOne() {
+    size_t self = currentQueue();
+    Task task;
+
+    for (size_t i = 0; i < queues.size() && !task; i++) {
+        size_t victim = (self + i) % queues.size();
+        Queue& queue = *queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (victim == self) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+
+    if (!task) {
+        return false;
+    }
+    queuedTasks--;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    workerPool = this;
+    workerIndex = index;
+
+    while (true) {
+        if (runOne()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] { return stopping || queuedTasks > 0; });
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallelFor(size_t first, size_t last, size_t grain,
+                             const std::function<void(size_t, size_t)>& body) {
+    grain = std::max<size_t>(1, grain);
+    TaskGroup group(*this);
+    for (size_t begin = first; begin < last; begin += grain) {
+        size_t end = std::min(last, begin + grain);
+        group.spawn([&body, begin, end] { body(begin, end); });
+    }
+    group.wait();
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool) : pool(pool), remaining(0) {}
+
+TaskGroup::~TaskGroup() {
+    while (remaining > 0) {
+        if (!pool.runOne()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void TaskGroup::spawn(ThreadPool::Task task) {
+    remaining++;
+    pool.push([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        remaining--;
+    });
+}
+
+void TaskGroup::wait() {
+    while (remaining > 0) {
+        if (!pool.runOne()) {
+            std::this_thread::yield();
+        }
+    }
+    if (error) {
+        std::exception_ptr pending = error;
+        error = nullptr;
+        std::rethrow_exception(pending);
+    }
+}
@@ -0,0 +1,79 @@
+// thread_pool.h
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing pool. Each thread owns a deque: it pushes and pops its own
+// tasks at the back (newest first, which keeps recursive work cache-local) and
+// steals from the front of other deques when it runs dry.
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    // threadCount counts the calling thread, which helps while it waits, so a
+    // pool of N runs N - 1 background threads. 0 means one per hardware thread.
+    explicit ThreadPool(size_t threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t getThreadCount() const { return queues.size(); }
+
+    // Calls body(begin, end) over [first, last) split into chunks of at most
+    // grain items and returns once all chunks are done.
+    void parallelFor(size_t first, size_t last, size_t grain,
+                     const std::function<void(size_t, size_t)>& body);
+
+private:
+    friend class TaskGroup;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<size_t> queuedTasks;
+    bool stopping;
+
+    void push(Task task);
+    bool runOne();
+    void workerLoop(size_t index);
+    size_t currentQueue() const;
+};
+
+// A set of tasks spawned onto a pool that can be waited on together. Waiting
+// runs queued tasks instead of blocking, so groups can be nested freely.
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& pool);
+    ~TaskGroup();
+
+    void spawn(ThreadPool::Task task);
+
+    // Blocks until every spawned task has finished and rethrows the first
+    // exception any of them raised.
+    void wait();
+
+private:
+    ThreadPool& pool;
+    std::atomic<size_t> remaining;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+#endif // THREAD_POOL_H
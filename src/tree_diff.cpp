@@ -0,0 +1,227 @@
+// tree_diff.cpp
+#include "tree_diff.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+static_assert(std::endian::native == std::endian::little, "peer messages are little-endian");
+
+namespace {
+
+const uint8_t REQUEST_BYE = 0;
+const uint8_t REQUEST_LEAF_COUNT = 1;
+const uint8_t REQUEST_NODES = 2;
+
+// Reads exactly size bytes. Returns false if the stream ends before the first
+// byte; ending anywhere else is an error.
+bool readFully(int fd, void* data, size_t size) {
+    byte* cursor = static_cast<byte*>(data);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::read(fd, cursor + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error(std::string("Tree peer read failed: ") + std::strerror(errno));
+        }
+        if (n == 0) {
+            if (done == 0) {
+                return false;
+            }
+            throw std::runtime_error("Tree peer closed the stream mid-message.");
+        }
+        done += n;
+    }
+    return true;
+}
+
+void readExact(int fd, void* data, size_t size) {
+    if (!readFully(fd, data, size)) {
+        throw std::runtime_error("Tree peer closed the stream.");
+    }
+}
+
+void writeFully(int fd, const void* data, size_t size) {
+    const byte* cursor = static_cast<const byte*>(data);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::write(fd, cursor + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            throw std::runtime_error(std::string("Tree peer write failed: ") + std::strerror(errno));
+        }
+        done += n;
+    }
+}
+
+size_t levelSizeFor(size_t leafCount, size_t level) {
+    return ((leafCount - 1) >> level) + 1;
+}
+
+size_t levelCountFor(size_t leafCount) {
+    size_t levels = 1;
+    while (levelSizeFor(leafCount, levels - 1) > 1) {
+        levels++;
+    }
+    return levels;
+}
+
+} // namespace
+
+PipeTreePeer::~PipeTreePeer() {
+    uint8_t bye = REQUEST_BYE;
+    ssize_t ignored = ::write(writeFd, &bye, 1);
+    (void)ignored;
+}
+
+size_t PipeTreePeer::getLeafCount() {
+    uint8_t request = REQUEST_LEAF_COUNT;
+    writeFully(writeFd, &request, 1);
+    uint64_t leafCount;
+    readExact(readFd, &leafCount, sizeof(leafCount));
+    if (leafCount == 0) {
+        throw std::runtime_error("Tree peer reported an empty tree.");
+    }
+    return leafCount;
+}
+
+std::vector<Digest> PipeTreePeer::getNodes(size_t level, std::span<const size_t> indices) {
+    ByteArray request(1 + 2 * sizeof(uint32_t) + indices.size() * sizeof(uint64_t));
+    uint32_t header[2] = {uint32_t(level), uint32_t(indices.size())};
+    request[0] = REQUEST_NODES;
+    std::memcpy(&request[1], header, sizeof(header));
+    for (size_t i = 0; i < indices.size(); i++) {
+        uint64_t index = indices[i];
+        std::memcpy(&request[1 + sizeof(header) + i * sizeof(index)], &index, sizeof(index));
+    }
+    writeFully(writeFd, request.data(), request.size());
+
+    std::vector<Digest> digests(indices.size());
+    readExact(readFd, digests.data(), digests.size() * sizeof(Digest));
+    return digests;
+}
+
+template <typename HashPolicy>
+void serveTreePeer(const BasicMerkleTree<HashPolicy>& tree, int readFd, int writeFd) {
+    std::vector<uint64_t> indices;
+    std::vector<Digest> reply;
+
+    while (true) {
+        uint8_t type;
+        if (!readFully(readFd, &type, 1) || type == REQUEST_BYE) {
+            return;
+        }
+
+        if (type == REQUEST_LEAF_COUNT) {
+            uint64_t leafCount = tree.getLeafCount();
+            writeFully(writeFd, &leafCount, sizeof(leafCount));
+            continue;
+        }
+        if (type != REQUEST_NODES) {
+            throw std::runtime_error("Unknown tree peer request " + std::to_string(type));
+        }
+
+        uint32_t header[2];
+        readExact(readFd, header, sizeof(header));
+        uint32_t level = header[0];
+        uint32_t count = header[1];
+        if (level >= tree.getLevelCount() || count > tree.getLevelSize(level)) {
+            throw std::runtime_error("Tree peer request does not fit the tree.");
+        }
+
+        indices.resize(count);
+        readExact(readFd, indices.data(), count * sizeof(uint64_t));
+        reply.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            reply[i] = tree.getNodeHash(level, indices[i]);
+        }
+        writeFully(writeFd, reply.data(), reply.size() * sizeof(Digest));
+    }
+}
+
+template <typename HashPolicy>
+std::vector<size_t> diffWithPeer(const BasicMerkleTree<HashPolicy>& local, TreePeer& peer, DiffStats* stats) {
+    DiffStats counted;
+    size_t localLeaves = local.getLeafCount();
+    size_t peerLeaves = peer.getLeafCount();
+    size_t top = std::min(local.getLevelCount(), levelCountFor(peerLeaves)) - 1;
+
+    // A node at (level, i) covers the same leaves in both trees unless it is
+    // the last one of a tree, and then its digest differs anyway.
+    std::vector<size_t> frontier(std::max(local.getLevelSize(top), levelSizeFor(peerLeaves, top)));
+    std::iota(frontier.begin(), frontier.end(), 0);
+
+    std::vector<size_t> differing;
+    std::vector<size_t> shared;
+    std::vector<size_t> next;
+
+    for (size_t level = top; ; level--) {
+        size_t localSize = local.getLevelSize(level);
+        size_t peerSize = levelSizeFor(peerLeaves, level);
+
+        shared.clear();
+        for (size_t index : frontier) {
+            if (index < localSize && index < peerSize) {
+                shared.push_back(index);
+                continue;
+            }
+            // Only one side has this node, so every leaf below it differs.
+            size_t leaves = index < localSize ? localLeaves : peerLeaves;
+            for (size_t leaf = index << level; leaf < std::min(leaves, (index + 1) << level); leaf++) {
+                differing.push_back(leaf);
+            }
+        }
+
+        next.clear();
+        if (!shared.empty()) {
+            std::vector<Digest> remote = peer.getNodes(level, shared);
+            if (remote.size() != shared.size()) {
+                throw std::runtime_error("Tree peer answered with the wrong number of digests.");
+            }
+            counted.rounds++;
+            counted.comparisons += shared.size();
+
+            size_t childCount = 0;
+            if (level > 0) {
+                childCount = std::max(local.getLevelSize(level - 1), levelSizeFor(peerLeaves, level - 1));
+            }
+            for (size_t i = 0; i < shared.size(); i++) {
+                if (local.getNodeHash(level, shared[i]) == remote[i]) {
+                    continue;
+                }
+                if (level == 0) {
+                    differing.push_back(shared[i]);
+                    continue;
+                }
+                next.push_back(2 * shared[i]);
+                if (2 * shared[i] + 1 < childCount) {
+                    next.push_back(2 * shared[i] + 1);
+                }
+            }
+        }
+
+        if (level == 0 || next.empty()) {
+            break;
+        }
+        frontier.swap(next);
+    }
+
+    std::sort(differing.begin(), differing.end());
+    if (stats != nullptr) {
+        *stats = counted;
+    }
+    return differing;
+}
+
+template void serveTreePeer(const MerkleTree&, int, int);
+template void serveTreePeer(const Blake3MerkleTree&, int, int);
+template std::vector<size_t> diffWithPeer(const MerkleTree&, TreePeer&, DiffStats*);
+template std::vector<size_t> diffWithPeer(const Blake3MerkleTree&, TreePeer&, DiffStats*);
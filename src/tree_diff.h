@@ -0,0 +1,90 @@
+// tree_diff.h
+#ifndef TREE_DIFF_H
+#define TREE_DIFF_H
+
+#include "merkle_tree.h"
+#include <span>
+#include <vector>
+
+// The other side of a diff: a replica that answers with stored node digests.
+// Each getNodes() call is one round trip, so the diff asks for every node it
+// needs on a level at once.
+class TreePeer {
+public:
+    virtual ~TreePeer() = default;
+
+    virtual size_t getLeafCount() = 0;
+
+    // Digests of nodes indices[i] on level, in request order.
+    virtual std::vector<Digest> getNodes(size_t level, std::span<const size_t> indices) = 0;
+};
+
+// In-process peer over a tree that is directly readable.
+template <typename HashPolicy = Sha256Policy>
+class LocalTreePeer : public TreePeer {
+public:
+    explicit LocalTreePeer(const BasicMerkleTree<HashPolicy>& tree) : tree(tree) {}
+
+    size_t getLeafCount() override { return tree.getLeafCount(); }
+
+    std::vector<Digest> getNodes(size_t level, std::span<const size_t> indices) override {
+        std::vector<Digest> digests;
+        digests.reserve(indices.size());
+        for (size_t index : indices) {
+            digests.push_back(tree.getNodeHash(level, index));
+        }
+        return digests;
+    }
+
+private:
+    const BasicMerkleTree<HashPolicy>& tree;
+};
+
+// Peer on the far end of a byte stream (pipe, socket) served by serveTreePeer().
+// Requests and replies are little-endian; a node request is
+//   u8 NODES, u32 level, u32 count, count * u64 index  ->  count * 32-byte digest
+// and a leaf count request is u8 LEAF_COUNT -> u64. Throws std::runtime_error if
+// the stream fails or closes.
+class PipeTreePeer : public TreePeer {
+public:
+    PipeTreePeer(int readFd, int writeFd) : readFd(readFd), writeFd(writeFd) {}
+
+    // Tells the server to return. The descriptors stay open.
+    ~PipeTreePeer() override;
+
+    size_t getLeafCount() override;
+
+    std::vector<Digest> getNodes(size_t level, std::span<const size_t> indices) override;
+
+private:
+    int readFd;
+    int writeFd;
+};
+
+// Answers PipeTreePeer requests about tree until the client says goodbye or
+// closes its end.
+template <typename HashPolicy>
+void serveTreePeer(const BasicMerkleTree<HashPolicy>& tree, int readFd, int writeFd);
+
+struct DiffStats {
+    size_t rounds = 0;        // getNodes() calls
+    size_t comparisons = 0;   // node digests compared
+};
+
+// Leaf indices whose digests differ between local and peer, ascending. Leaves
+// that exist on only one side count as differing. The walk starts at the top
+// level both trees share and only descends below nodes that differ, level by
+// level, so k differing leaves cost O(k log n) comparisons in at most one
+// round per level.
+template <typename HashPolicy>
+std::vector<size_t> diffWithPeer(const BasicMerkleTree<HashPolicy>& local, TreePeer& peer,
+                                 DiffStats* stats = nullptr);
+
+template <typename HashPolicy>
+std::vector<size_t> diffTrees(const BasicMerkleTree<HashPolicy>& a, const BasicMerkleTree<HashPolicy>& b,
+                              DiffStats* stats = nullptr) {
+    LocalTreePeer<HashPolicy> peer(b);
+    return diffWithPeer(a, peer, stats);
+}
+
+#endif // TREE_DIFF_H
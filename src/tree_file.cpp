@@ -0,0 +1,152 @@
+// tree_file.cpp
+#include "merkle_tree.h"
+#include "mapped_file.h"
+#include "sha256_simd.h"
+#include "tree_file.h"
+#include <bit>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <sys/mman.h>
+
+static_assert(std::endian::native == std::endian::little, "tree files are stored little-endian");
+
+namespace {
+
+size_t countNodes(size_t leafCount) {
+    size_t total = 0;
+    for (size_t size = leafCount; ; size = (size + 1) / 2) {
+        total += size;
+        if (size == 1) {
+            return total;
+        }
+    }
+}
+
+Digest headerChecksum(const TreeFileHeader& header) {
+    return sha256Digest(reinterpret_cast<const byte*>(&header), offsetof(TreeFileHeader, headerChecksum));
+}
+
+} // namespace
+
+template <typename HashPolicy>
+void BasicMerkleTree<HashPolicy>::save(const std::string& path) const {
+    TreeFileHeader header = {};
+    std::memcpy(header.magic, TREE_FILE_MAGIC, sizeof(header.magic));
+    header.version = TREE_FILE_VERSION;
+    header.hashId = HashPolicy::hashId;
+    header.leafCount = numLeaves;
+    header.nodeCount = countNodes(numLeaves);
+    header.bodyOffset = TREE_FILE_BODY_OFFSET;
+
+    const Digest& root = nodeAt(levelCount - 1, 0);
+    std::copy(root.begin(), root.end(), header.root);
+
+    Sha256Stream bodyHash;
+    for (size_t level = 0; level < levelCount; level++) {
+        bodyHash.update(reinterpret_cast<const byte*>(levelData(level)), levelSize(level) * sizeof(Digest));
+    }
+    Digest bodyChecksum = bodyHash.finish();
+    std::copy(bodyChecksum.begin(), bodyChecksum.end(), header.bodyChecksum);
+
+    Digest checksum = headerChecksum(header);
+    std::copy(checksum.begin(), checksum.end(), header.headerChecksum);
+
+    // Write beside the target and rename, so readers never map a partial file.
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot create " + temporaryPath);
+        }
+
+        ByteArray headerPage(TREE_FILE_BODY_OFFSET, 0);
+        std::memcpy(headerPage.data(), &header, sizeof(header));
+        out.write(reinterpret_cast<const char*>(headerPage.data()), headerPage.size());
+        for (size_t level = 0; level < levelCount; level++) {
+            out.write(reinterpret_cast<const char*>(levelData(level)), levelSize(level) * sizeof(Digest));
+        }
+
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Cannot write " + temporaryPath);
+        }
+    }
+
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::remove(temporaryPath.c_str());
+        throw std::runtime_error("Cannot replace " + path);
+    }
+}
+
+template <typename HashPolicy>
+BasicMerkleTree<HashPolicy> BasicMerkleTree<HashPolicy>::openMapped(const std::string& path, bool verifyBody) {
+    std::shared_ptr<MappedFile> file = MappedFile::open(path);
+
+    if (file->size() < sizeof(TreeFileHeader)) {
+        throw std::runtime_error(path + " is too small to be a tree file.");
+    }
+    TreeFileHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    if (std::memcmp(header.magic, TREE_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(path + " is not a tree file.");
+    }
+    if (header.version != TREE_FILE_VERSION) {
+        throw std::runtime_error(path + " has unsupported tree file version " + std::to_string(header.version));
+    }
+    Digest checksum = headerChecksum(header);
+    if (!std::equal(checksum.begin(), checksum.end(), header.headerChecksum)) {
+        throw std::runtime_error(path + " has a corrupt header.");
+    }
+    if (header.hashId != HashPolicy::hashId) {
+        throw std::runtime_error(path + " uses hash id " + std::to_string(header.hashId) +
+                                 ", expected " + std::to_string(HashPolicy::hashId));
+    }
+    if (header.leafCount == 0 || header.nodeCount != countNodes(header.leafCount) ||
+        header.bodyOffset % alignof(Digest) != 0 ||
+        header.bodyOffset > file->size() ||
+        (file->size() - header.bodyOffset) / sizeof(Digest) < header.nodeCount) {
+        throw std::runtime_error(path + " has an inconsistent size.");
+    }
+
+    const byte* body = file->data() + header.bodyOffset;
+    if (verifyBody) {
+        Digest bodyChecksum = sha256Digest(body, header.nodeCount * sizeof(Digest));
+        if (!std::equal(bodyChecksum.begin(), bodyChecksum.end(), header.bodyChecksum)) {
+            throw std::runtime_error(path + " has a corrupt body.");
+        }
+    }
+
+    // Proof lookups touch one digest per level, so readahead would only waste I/O.
+    madvise(const_cast<byte*>(file->data()), file->size(), MADV_RANDOM);
+
+    BasicMerkleTree tree;
+    tree.mapping = file;
+    tree.mappedNodes = reinterpret_cast<const Digest*>(body);
+    tree.numLeaves = header.leafCount;
+    tree.leafCapacity = header.leafCount;
+    tree.levelOffsets.assign(1, 0);
+    tree.levelCount = 0;
+    for (size_t size = tree.numLeaves; ; size = (size + 1) / 2) {
+        tree.levelOffsets.push_back(tree.levelOffsets.back() + size);
+        tree.levelCount++;
+        if (size == 1) {
+            break;
+        }
+    }
+
+    const Digest& root = tree.nodeAt(tree.levelCount - 1, 0);
+    if (!std::equal(root.begin(), root.end(), header.root)) {
+        throw std::runtime_error(path + " root does not match its header.");
+    }
+
+    return tree;
+}
+
+template void MerkleTree::save(const std::string&) const;
+template void Blake3MerkleTree::save(const std::string&) const;
+template MerkleTree MerkleTree::openMapped(const std::string&, bool);
+template Blake3MerkleTree Blake3MerkleTree::openMapped(const std::string&, bool);
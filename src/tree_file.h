@@ -0,0 +1,34 @@
+// tree_file.h
+#ifndef TREE_FILE_H
+#define TREE_FILE_H
+
+#include "hash.h"
+#include <cstdint>
+
+// On-disk layout written by MerkleTree::save() and read by openMapped():
+//
+//   [0, sizeof(TreeFileHeader))   header, little-endian
+//   [bodyOffset, ...)             every level's digests back to back, leaves
+//                                 first, level h holding ceil(n / 2^h) entries
+//
+// The body starts on a page boundary so it can be used in place from a mapping.
+
+const char TREE_FILE_MAGIC[8] = {'M', 'R', 'K', 'L', 'T', 'R', 'E', 'E'};
+const uint32_t TREE_FILE_VERSION = 1;
+const uint64_t TREE_FILE_BODY_OFFSET = 4096;
+
+struct TreeFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t hashId;          // HashPolicy::hashId of the tree (hash_policy.h)
+    uint64_t leafCount;
+    uint64_t nodeCount;
+    uint64_t bodyOffset;
+    byte root[32];
+    byte bodyChecksum[32];    // SHA-256 of the whole body
+    byte headerChecksum[32];  // SHA-256 of every header byte before this field
+};
+
+static_assert(sizeof(TreeFileHeader) == 136, "tree file header must not contain padding");
+
+#endif // TREE_FILE_H
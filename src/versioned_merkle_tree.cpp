@@ -0,0 +1,322 @@
+// versioned_merkle_tree.cpp
+#include "versioned_merkle_tree.h"
+#include "stats.h"
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+// Leaves in the left subtree of a node over size >= 2 leaves: the largest
+// power of two below size, which is the shape MerkleTree's carried-up levels
+// produce.
+size_t leftSize(size_t size) {
+    return std::bit_floor(size - 1);
+}
+
+} // namespace
+
+template <typename HashPolicy>
+BasicVersionedMerkleTree<HashPolicy>::BasicVersionedMerkleTree(const std::vector<ByteArray>& data,
+                                                               size_t maxReaders)
+    : current(nullptr), latest(0), epoch(0), slots(new ReaderSlot[std::max<size_t>(maxReaders, 1)]),
+      slotCount(std::max<size_t>(maxReaders, 1)) {
+    if (data.empty()) {
+        throw std::invalid_argument("Cannot create Merkle tree with empty data.");
+    }
+    for (size_t i = 0; i < slotCount; i++) {
+        slots[i].epoch.store(IDLE);
+    }
+
+    std::vector<Digest> hashes(data.size());
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        HashPolicy::leafBatch(data.data(), data.size(), hashes.data());
+    }
+
+    MERKLE_PHASE(Phase::LevelBuilding);
+    std::vector<Node*> level(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        level[i] = allocate(hashes[i], nullptr, nullptr);
+    }
+
+    // Level by level as MerkleTree builds, an odd last node carried up as is.
+    std::vector<Digest> pairs;
+    while (level.size() > 1) {
+        size_t pairCount = level.size() / 2;
+        pairs.resize(2 * pairCount);
+        for (size_t i = 0; i < 2 * pairCount; i++) {
+            pairs[i] = level[i]->hash;
+        }
+        hashes.resize(pairCount);
+        HashPolicy::combineBatch(pairs.data(), hashes.data(), pairCount);
+
+        std::vector<Node*> parents((level.size() + 1) / 2);
+        for (size_t i = 0; i < pairCount; i++) {
+            parents[i] = allocate(hashes[i], level[2 * i], level[2 * i + 1]);
+        }
+        if (level.size() % 2 == 1) {
+            parents.back() = level.back();
+        }
+        level.swap(parents);
+    }
+
+    current.store(new Version{level[0], data.size(), 0});
+}
+
+template <typename HashPolicy>
+BasicVersionedMerkleTree<HashPolicy>::~BasicVersionedMerkleTree() {
+    for (Retired& batch : retired) {
+        delete batch.version;
+    }
+    delete current.load();
+}
+
+template <typename HashPolicy>
+typename BasicVersionedMerkleTree<HashPolicy>::Snapshot BasicVersionedMerkleTree<HashPolicy>::snapshot() const {
+    // Readers start at different slots so they rarely race for one.
+    size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % slotCount;
+    for (size_t i = 0; i < slotCount; i++) {
+        size_t slot = (start + i) % slotCount;
+        uint64_t idle = IDLE;
+        // The slot must hold an epoch before current is read. A writer that
+        // scans the slots before this store has already published a newer
+        // version, so nothing this reader can load is being freed.
+        if (slots[slot].epoch.compare_exchange_strong(idle, epoch.load())) {
+            return Snapshot(this, slot, current.load());
+        }
+    }
+    throw std::runtime_error("Every reader slot is pinned.");
+}
+
+template <typename HashPolicy>
+void BasicVersionedMerkleTree<HashPolicy>::unpin(size_t slot) const {
+    slots[slot].epoch.store(IDLE);
+}
+
+template <typename HashPolicy>
+uint64_t BasicVersionedMerkleTree<HashPolicy>::updateLeaf(size_t index, const ByteArray& data) {
+    return applyUpdates(std::span<const size_t>(&index, 1), std::span<const ByteArray>(&data, 1));
+}
+
+template <typename HashPolicy>
+uint64_t BasicVersionedMerkleTree<HashPolicy>::applyUpdates(std::span<const size_t> indices,
+                                                            std::span<const ByteArray> data) {
+    if (indices.size() != data.size()) {
+        throw std::invalid_argument("Every update needs both an index and data.");
+    }
+    const Version* version = current.load();
+    for (size_t index : indices) {
+        if (index >= version->leafCount) {
+            throw std::out_of_range("Index out of range");
+        }
+    }
+
+    std::vector<Digest> leafHashes(data.size());
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        HashPolicy::leafBatch(data.data(), data.size(), leafHashes.data());
+    }
+
+    // A stable sort keeps repeated indices in call order, so the last one
+    // ends each run.
+    std::vector<std::pair<size_t, Digest>> updates(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        updates[i] = {indices[i], leafHashes[i]};
+    }
+    std::stable_sort(updates.begin(), updates.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    Node* root = version->root;
+    if (!updates.empty()) {
+        MERKLE_PHASE(Phase::LevelBuilding);
+        root = rebuild(root, 0, version->leafCount, updates.data(), updates.size());
+    }
+    return commit(root, version->leafCount);
+}
+
+template <typename HashPolicy>
+uint64_t BasicVersionedMerkleTree<HashPolicy>::appendLeaf(const ByteArray& data) {
+    const Version* version = current.load();
+    Digest leafHash;
+    {
+        MERKLE_PHASE(Phase::LeafHashing);
+        leafHash = HashPolicy::leaf(data.data(), data.size());
+    }
+
+    MERKLE_PHASE(Phase::LevelBuilding);
+    Node* root = append(version->root, version->leafCount, allocate(leafHash, nullptr, nullptr));
+    return commit(root, version->leafCount + 1);
+}
+
+template <typename HashPolicy>
+typename BasicVersionedMerkleTree<HashPolicy>::Node*
+BasicVersionedMerkleTree<HashPolicy>::allocate(const Digest& hash, Node* left, Node* right) {
+    if (freeNodes.empty()) {
+        slabs.emplace_back(new Node[SLAB_NODES]);
+        for (size_t i = SLAB_NODES; i > 0; i--) {
+            freeNodes.push_back(&slabs.back()[i - 1]);
+        }
+    }
+    Node* node = freeNodes.back();
+    freeNodes.pop_back();
+    *node = Node{hash, left, right};
+    liveNodes++;
+    return node;
+}
+
+template <typename HashPolicy>
+typename BasicVersionedMerkleTree<HashPolicy>::Node*
+BasicVersionedMerkleTree<HashPolicy>::combine(Node* left, Node* right) {
+    return allocate(HashPolicy::combine(left->hash, right->hash), left, right);
+}
+
+template <typename HashPolicy>
+typename BasicVersionedMerkleTree<HashPolicy>::Node*
+BasicVersionedMerkleTree<HashPolicy>::rebuild(Node* node, size_t first, size_t size,
+                                              const std::pair<size_t, Digest>* updates, size_t count) {
+    dropped.push_back(node);
+    if (size == 1) {
+        return allocate(updates[count - 1].second, nullptr, nullptr);
+    }
+
+    size_t split = leftSize(size);
+    size_t leftCount = std::partition_point(updates, updates + count,
+                                            [&](const auto& update) { return update.first < first + split; }) - updates;
+    Node* left = node->left;
+    Node* right = node->right;
+    if (leftCount > 0) {
+        left = rebuild(left, first, split, updates, leftCount);
+    }
+    if (leftCount < count) {
+        right = rebuild(right, first + split, size - split, updates + leftCount, count - leftCount);
+    }
+    return combine(left, right);
+}
+
+template <typename HashPolicy>
+typename BasicVersionedMerkleTree<HashPolicy>::Node*
+BasicVersionedMerkleTree<HashPolicy>::append(Node* node, size_t size, Node* leaf) {
+    // A perfect tree becomes the left half of the new one. Otherwise the left
+    // subtree is already perfect and the leaf joins the right one.
+    if (std::has_single_bit(size)) {
+        return combine(node, leaf);
+    }
+    dropped.push_back(node);
+    size_t split = leftSize(size);
+    return combine(node->left, append(node->right, size - split, leaf));
+}
+
+template <typename HashPolicy>
+uint64_t BasicVersionedMerkleTree<HashPolicy>::commit(Node* root, size_t leafCount) {
+    Version* previous = current.load();
+    Version* next = new Version{root, leafCount, previous->number + 1};
+    current.store(next);
+    latest.store(next->number);
+
+    // Readers that pin from here on read the new epoch, and with it the new
+    // version, so what was dropped is only visible to older epochs.
+    uint64_t dropEpoch = epoch.load();
+    retired.push_back(Retired{dropEpoch, std::move(dropped), previous});
+    dropped.clear();
+    epoch.store(dropEpoch + 1);
+
+    reclaim();
+    return next->number;
+}
+
+template <typename HashPolicy>
+void BasicVersionedMerkleTree<HashPolicy>::reclaim() {
+    uint64_t oldest = IDLE;
+    for (size_t i = 0; i < slotCount; i++) {
+        oldest = std::min(oldest, slots[i].epoch.load());
+    }
+
+    size_t freed = 0;
+    while (freed < retired.size() && retired[freed].epoch < oldest) {
+        Retired& batch = retired[freed++];
+        freeNodes.insert(freeNodes.end(), batch.nodes.begin(), batch.nodes.end());
+        liveNodes -= batch.nodes.size();
+        delete batch.version;
+    }
+    retired.erase(retired.begin(), retired.begin() + freed);
+}
+
+template <typename HashPolicy>
+BasicVersionedMerkleTree<HashPolicy>::Snapshot::Snapshot(Snapshot&& other) noexcept
+    : tree(other.tree), slot(other.slot), version(other.version) {
+    other.tree = nullptr;
+}
+
+template <typename HashPolicy>
+typename BasicVersionedMerkleTree<HashPolicy>::Snapshot&
+BasicVersionedMerkleTree<HashPolicy>::Snapshot::operator=(Snapshot&& other) noexcept {
+    if (this != &other) {
+        release();
+        tree = other.tree;
+        slot = other.slot;
+        version = other.version;
+        other.tree = nullptr;
+    }
+    return *this;
+}
+
+template <typename HashPolicy>
+BasicVersionedMerkleTree<HashPolicy>::Snapshot::~Snapshot() {
+    release();
+}
+
+template <typename HashPolicy>
+void BasicVersionedMerkleTree<HashPolicy>::Snapshot::release() {
+    if (tree != nullptr) {
+        tree->unpin(slot);
+        tree = nullptr;
+    }
+}
+
+template <typename HashPolicy>
+uint64_t BasicVersionedMerkleTree<HashPolicy>::Snapshot::getVersion() const {
+    return version->number;
+}
+
+template <typename HashPolicy>
+size_t BasicVersionedMerkleTree<HashPolicy>::Snapshot::getLeafCount() const {
+    return version->leafCount;
+}
+
+template <typename HashPolicy>
+ByteArray BasicVersionedMerkleTree<HashPolicy>::Snapshot::getRootHash() const {
+    return digestToBytes(version->root->hash);
+}
+
+template <typename HashPolicy>
+std::vector<Digest> BasicVersionedMerkleTree<HashPolicy>::Snapshot::generateProof(size_t index) const {
+    if (index >= version->leafCount) {
+        throw std::out_of_range("Index out of range");
+    }
+    MERKLE_PHASE(Phase::ProofGeneration);
+
+    // Siblings are met top-down on the way to the leaf.
+    std::vector<Digest> proof;
+    const Node* node = version->root;
+    for (size_t size = version->leafCount; size > 1; ) {
+        size_t split = leftSize(size);
+        if (index < split) {
+            proof.push_back(node->right->hash);
+            node = node->left;
+            size = split;
+        } else {
+            proof.push_back(node->left->hash);
+            node = node->right;
+            index -= split;
+            size -= split;
+        }
+    }
+    std::reverse(proof.begin(), proof.end());
+    return proof;
+}
+
+template class BasicVersionedMerkleTree<Sha256Policy>;
+template class BasicVersionedMerkleTree<Blake3Policy>;
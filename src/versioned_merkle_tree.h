@@ -0,0 +1,162 @@
+// versioned_merkle_tree.h
+#ifndef VERSIONED_MERKLE_TREE_H
+#define VERSIONED_MERKLE_TREE_H
+
+#include "hash.h"
+#include "hash_policy.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// A persistent Merkle tree: every commit makes a new version that shares each
+// untouched subtree with the version before it, so an update allocates only
+// the O(log n) nodes on its changed paths. The tree has MerkleTree's shape,
+// and a version's root and proofs equal those of a MerkleTree over its leaves.
+//
+// One writer commits versions while any number of readers pin snapshots. A
+// reader never takes a lock: pinning publishes the current epoch in a reader
+// slot and loads the latest version; the pinned version then stays valid
+// however many commits follow. Nodes dropped by a commit are retired under
+// the epoch they were dropped in and freed once no slot holds an epoch at or
+// before it. Nodes carry no reference counts and are recycled through the
+// writer's own free list.
+template <typename HashPolicy = Sha256Policy>
+class BasicVersionedMerkleTree {
+    static_assert(HashPolicy::digestSize == sizeof(Digest), "node storage holds fixed 32-byte digests");
+
+    struct Node;
+    struct Version;
+
+public:
+    // A pinned version. Release it (or let it go out of scope) promptly:
+    // nodes retired since it was pinned are kept until then.
+    class Snapshot {
+    public:
+        Snapshot(Snapshot&& other) noexcept;
+        Snapshot& operator=(Snapshot&& other) noexcept;
+        ~Snapshot();
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        uint64_t getVersion() const;
+
+        size_t getLeafCount() const;
+
+        ByteArray getRootHash() const;
+
+        // Siblings bottom-up, as MerkleTree::generateProof() and accepted by
+        // MerkleTree::verifyProof(). Throws std::out_of_range for a bad index.
+        std::vector<Digest> generateProof(size_t index) const;
+
+        void release();
+
+    private:
+        friend class BasicVersionedMerkleTree;
+
+        Snapshot(const BasicVersionedMerkleTree* tree, size_t slot, const Version* version)
+            : tree(tree), slot(slot), version(version) {}
+
+        const BasicVersionedMerkleTree* tree;
+        size_t slot;
+        const Version* version;
+    };
+
+    // Version 0 holds data. Throws std::invalid_argument for empty data. At
+    // most maxReaders snapshots can be pinned at once.
+    explicit BasicVersionedMerkleTree(const std::vector<ByteArray>& data, size_t maxReaders = 64);
+
+    // Every snapshot must be released before the tree is destroyed.
+    ~BasicVersionedMerkleTree();
+
+    BasicVersionedMerkleTree(const BasicVersionedMerkleTree&) = delete;
+    BasicVersionedMerkleTree& operator=(const BasicVersionedMerkleTree&) = delete;
+
+    // Pins the latest version. Lock-free; throws std::runtime_error if
+    // maxReaders snapshots are already pinned.
+    Snapshot snapshot() const;
+
+    // The writer side. Each call commits one version and returns its number;
+    // calls must not overlap, but may run alongside any number of readers.
+    uint64_t updateLeaf(size_t index, const ByteArray& data);
+
+    // Replaces leaves indices[i] with data[i] in one version. An ancestor of
+    // several updated leaves is copied and hashed once. If an index repeats,
+    // the last update wins.
+    uint64_t applyUpdates(std::span<const size_t> indices, std::span<const ByteArray> data);
+
+    uint64_t appendLeaf(const ByteArray& data);
+
+    // The latest committed version.
+    uint64_t getVersion() const { return latest.load(); }
+
+    // Nodes allocated and not yet reclaimed, across the latest version and
+    // every version a snapshot may still hold. Writer side only.
+    size_t getLiveNodeCount() const { return liveNodes; }
+
+private:
+    struct Node {
+        Digest hash;
+        Node* left;
+        Node* right;
+    };
+
+    struct Version {
+        Node* root;
+        size_t leafCount;
+        uint64_t number;
+    };
+
+    // Nodes and the version a commit dropped, freed once every reader has
+    // moved past epoch.
+    struct Retired {
+        uint64_t epoch;
+        std::vector<Node*> nodes;
+        Version* version;
+    };
+
+    // One per cache line, so pinning readers do not contend.
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch;
+    };
+
+    static constexpr uint64_t IDLE = UINT64_MAX;
+    static constexpr size_t SLAB_NODES = 4096;
+
+    std::atomic<Version*> current;
+    std::atomic<uint64_t> latest;
+    std::atomic<uint64_t> epoch;
+    std::unique_ptr<ReaderSlot[]> slots;
+    size_t slotCount;
+
+    // Writer-only state.
+    std::vector<std::unique_ptr<Node[]>> slabs;
+    std::vector<Node*> freeNodes;
+    std::vector<Node*> dropped;
+    std::vector<Retired> retired;
+    size_t liveNodes = 0;
+
+    Node* allocate(const Digest& hash, Node* left, Node* right);
+    Node* combine(Node* left, Node* right);
+
+    // Copies the path from node (over size leaves starting at first) to each
+    // leaf in updates, which is sorted by index.
+    Node* rebuild(Node* node, size_t first, size_t size,
+                  const std::pair<size_t, Digest>* updates, size_t count);
+
+    Node* append(Node* node, size_t size, Node* leaf);
+
+    uint64_t commit(Node* root, size_t leafCount);
+    void reclaim();
+
+    void unpin(size_t slot) const;
+};
+
+typedef BasicVersionedMerkleTree<Sha256Policy> VersionedMerkleTree;
+
+extern template class BasicVersionedMerkleTree<Sha256Policy>;
+extern template class BasicVersionedMerkleTree<Blake3Policy>;
+
+#endif // VERSIONED_MERKLE_TREE_H